@@ -51,6 +51,9 @@ struct State {
         incppect::getInstance().var("state.ball[%d].y", [this](const auto & idxs) { return incppect::view(balls[idxs[0]].y); });
         incppect::getInstance().var("state.ball[%d].vx", [this](const auto & idxs) { return incppect::view(balls[idxs[0]].vx); });
         incppect::getInstance().var("state.ball[%d].vy", [this](const auto & idxs) { return incppect::view(balls[idxs[0]].vy); });
+
+        // allows clients to request e.g. "state.ball[*].x" or "state.*"
+        incppect::getInstance().extent("state.ball", [this](const auto & idxs) { return int32_t(balls.size()); });
     }
 
     void init(int nBalls) {
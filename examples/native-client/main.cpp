@@ -0,0 +1,91 @@
+/*! \file main.cpp
+ *  \brief Native client and load generator
+ *  \author Georgi Gerganov
+ */
+
+#include "incppect/client.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char ** argv) {
+    printf("Usage: %s [uri] [nClients] [paths...]\n", argv[0]);
+
+    std::string uri = argc > 1 ? argv[1] : "ws://localhost:3000/incppect";
+    int nClients = argc > 2 ? atoi(argv[2]) : 1;
+
+    std::vector<std::string> paths;
+    for (int i = 3; i < argc; ++i) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        paths = { "state.dt", "state.nballs", };
+    }
+
+    std::atomic<uint64_t> nFrames = 0;
+    std::atomic<uint64_t> nBytes = 0;
+    std::atomic<int> nActive = nClients;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < nClients; ++i) {
+        workers.emplace_back([&, i]() {
+            IncppectClient client;
+            if (client.connect(uri) == false) {
+                fprintf(stderr, "Client %d failed to connect to '%s'\n", i, uri.c_str());
+                --nActive;
+                return;
+            }
+
+            std::vector<int32_t> ids;
+            for (const auto & path : paths) {
+                ids.push_back(client.subscribe(path));
+            }
+
+            // print the values received by the first client
+            if (i == 0 && nClients == 1) {
+                client.onUpdate([&](int32_t id, std::string_view data) {
+                    printf("%-32s %8zu bytes", client.var(id).path.c_str(), data.size());
+                    if (data.size() == sizeof(float)) {
+                        printf("  %g (float)  %d (int32)", client.get<float>(id), client.get<int32_t>(id));
+                    }
+                    printf("\n");
+                });
+            }
+
+            uint64_t rx_bytes = 0;
+            while (true) {
+                const auto n = client.poll(100);
+                if (n < 0) {
+                    fprintf(stderr, "Client %d disconnected\n", i);
+                    break;
+                }
+
+                nFrames += n;
+                nBytes += client.stats().rx_bytes - rx_bytes;
+                rx_bytes = client.stats().rx_bytes;
+            }
+
+            --nActive;
+        });
+    }
+
+    while (nActive > 0) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        const uint64_t frames = nFrames.exchange(0);
+        const uint64_t bytes = nBytes.exchange(0);
+        printf("[%d clients] %8llu frames/s %10.3f MB/s\n", nClients, (unsigned long long) frames, bytes/1024.0/1024.0);
+    }
+
+    for (auto & worker : workers) {
+        worker.join();
+    }
+
+    return 0;
+}
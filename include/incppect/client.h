@@ -0,0 +1,1205 @@
+/*! \file client.h
+ *  \brief Native client for incppect services.
+ *  \author Georgi Gerganov
+ *
+ *  Header-only and independent of uWebSockets - it speaks just enough of the websocket protocol to talk to the service
+ *  (no TLS, no extensions). POSIX only.
+ */
+
+#pragma once
+
+#ifdef _WIN32
+#error "the incppect client requires POSIX sockets"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "codec.h"
+#include "path_trie.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Connects to an incppect service, subscribes to vars and keeps their latest values.
+// The deltas are applied in place, so the data of a var stays at the same address until its size changes.
+//
+//   IncppectClient client;
+//   client.connect("ws://localhost:3000/incppect"); // or "unix:/tmp/incppect.sock"
+//
+//   const auto id = client.subscribe("state.ball[3].x");
+//   while (client.poll(16) >= 0) {
+//      const float x = client.get<float>(id);
+//   }
+//
+// The client is not thread-safe - use one client per thread.
+struct IncppectClient
+{
+   // called for every var updated by a frame
+   using TUpdate = std::function<void(int32_t id, std::string_view data)>;
+
+   // status as in Incppect::RpcStatus: 0 - ok, 1 - unknown method, 2 - error
+   using TResponse = std::function<void(uint32_t status, std::string_view payload)>;
+
+   // var registered on the service, as in Incppect::VarOptions
+   struct SchemaEntry
+   {
+      std::string path{};
+      uint8_t type = 0;
+      uint8_t endianness = 0;
+      std::vector<int32_t> shape{};
+      bool isSettable = false;
+   };
+
+   using TSchema = std::function<void(const std::vector<SchemaEntry>& schema)>;
+
+   struct Var
+   {
+      std::string path{}; // with "[%d]" indices
+      std::vector<int> idxs{};
+
+      std::vector<uint32_t> buffer{};
+      uint32_t size_bytes = 0;
+      uint32_t seq = 0; // frame of the last update
+
+      std::vector<std::string> layout{}; // paths of the vars in a wildcard batch
+
+      // subscription state
+      bool isActive = false;
+      bool isActiveSent = false;
+      bool isRegistered = false;
+      int32_t tMinUpdate_ms = 0;
+      int32_t tMaxUpdate_ms = 0;
+      bool isRateChanged = false;
+
+      // quantization as requested and as applied by the service, see IncppectCodec::QuantizationMode
+      uint32_t quantization[3] = {}; // [mode][scale][offset], the floats stored as their bits
+      bool isQuantizationChanged = false;
+      uint32_t quantizationApplied[3] = {};
+
+      // filter as in IncppectCodec::FilterOp and the elements that pass it, by index
+      uint32_t filter = IncppectCodec::NoFilter;
+      double filterA = 0.0;
+      double filterB = 0.0;
+      bool isFilterChanged = false;
+      std::map<uint32_t, double> sparse{};
+   };
+
+   struct Stats
+   {
+      uint64_t rx_n = 0;
+      uint64_t rx_bytes = 0;
+      uint64_t tx_n = 0;
+      uint64_t tx_bytes = 0;
+
+      uint64_t frames = 0;
+      uint64_t keyframes = 0;
+      uint64_t seq_gaps = 0;
+      uint64_t record_errors = 0; // records that could not be applied, each triggers a keyframe
+   };
+
+   // interval of the keepalives and acknowledgements, must be well below Parameters::tLastRequestTimeout_ms
+   int64_t tRequestsUpdate_ms = 50;
+   uint32_t maxMessage_bytes = 64 * 1024 * 1024;
+
+   IncppectClient() = default;
+   IncppectClient(const IncppectClient&) = delete;
+   IncppectClient& operator=(const IncppectClient&) = delete;
+
+   ~IncppectClient() { disconnect(); }
+
+   // "ws://host:port/path" or "unix:/path/to/socket"
+   bool connect(const std::string& uri, int32_t timeout_ms = 3000)
+   {
+      disconnect();
+
+      if (uri.rfind("unix:", 0) == 0) {
+         isWebSocket = false;
+         fd = connectUnix(uri.substr(5));
+      }
+      else if (uri.rfind("ws://", 0) == 0) {
+         isWebSocket = true;
+
+         const auto rest = uri.substr(5);
+         const auto slash = rest.find('/');
+         const auto hostPort = rest.substr(0, slash);
+         const auto path = slash == std::string::npos ? std::string("/incppect") : rest.substr(slash);
+         const auto colon = hostPort.rfind(':');
+         const auto host = hostPort.substr(0, colon);
+         const auto port = colon == std::string::npos ? std::string("80") : hostPort.substr(colon + 1);
+
+         fd = connectTcp(host, port);
+         if (fd >= 0 && handshake(hostPort, path, timeout_ms) == false) {
+            ::close(fd);
+            fd = -1;
+         }
+      }
+
+      if (fd < 0) {
+         return false;
+      }
+
+      // the service starts every connection from scratch
+      for (auto& var : vars) {
+         var.isRegistered = false;
+         var.isActiveSent = false;
+         var.isRateChanged = var.tMinUpdate_ms > 0 || var.tMaxUpdate_ms > 0;
+         var.isQuantizationChanged = var.quantization[0] != IncppectCodec::None;
+         std::fill(std::begin(var.quantizationApplied), std::end(var.quantizationApplied), 0);
+         var.isFilterChanged = var.filter != IncppectCodec::NoFilter;
+         var.sparse.clear();
+      }
+      frame.clear();
+      frameSeq = 0;
+      keyframePending = false;
+      needsAck = false;
+      tLastRequests_ms = 0;
+
+      return true;
+   }
+
+   void disconnect()
+   {
+      if (fd >= 0) {
+         ::close(fd);
+         fd = -1;
+      }
+
+      inBuffer.clear();
+      fragments.clear();
+
+      for (auto& [callId, response] : pending) {
+         response(2, "connection closed");
+      }
+      pending.clear();
+   }
+
+   bool isConnected() const { return fd >= 0; }
+
+   // subscribe to a var, e.g. ("state.ball[%d].x", {3}), "state.ball[3].x" or the wildcard "state.ball[*].x"
+   // returns the id of the var, the same id is returned for the same path
+   int32_t subscribe(std::string_view path, const std::vector<int>& idxs = {})
+   {
+      const auto id = add(path, idxs);
+      vars[id].isActive = true;
+      return id;
+   }
+
+   // register a var without subscribing to it, e.g. to write to it with set()
+   int32_t add(std::string_view path, const std::vector<int>& idxs = {})
+   {
+      std::string pattern;
+      std::vector<int> parsed;
+      IncppectPathTrie::parse(path, pattern, parsed);
+      parsed.insert(parsed.end(), idxs.begin(), idxs.end());
+
+      auto [it, isNew] = ids.try_emplace({pattern, parsed}, int32_t(vars.size()));
+      if (isNew) {
+         auto& var = vars.emplace_back();
+         var.path = std::move(pattern);
+         var.idxs = std::move(parsed);
+      }
+
+      return it->second;
+   }
+
+   void unsubscribe(int32_t id)
+   {
+      if (id >= 0 && id < int32_t(vars.size())) {
+         vars[id].isActive = false;
+      }
+   }
+
+   // update at most maxHz times per second and at least minHz times per second, 0 - the service default
+   void setRate(int32_t id, double maxHz, double minHz = 0.0)
+   {
+      if (id < 0 || id >= int32_t(vars.size())) {
+         return;
+      }
+
+      auto& var = vars[id];
+      var.tMinUpdate_ms = maxHz > 0.0 ? int32_t(1000.0 / maxHz + 0.5) : 0;
+      var.tMaxUpdate_ms = minHz > 0.0 ? int32_t(1000.0 / minHz + 0.5) : 0;
+      var.isRateChanged = true;
+   }
+
+   // receive the float values of a var quantized, e.g. (id, IncppectCodec::Int16, 0.01f) - read them with values()
+   void quantize(int32_t id, uint32_t mode, float scale = 1.0f, float offset = 0.0f)
+   {
+      if (id < 0 || id >= int32_t(vars.size())) {
+         return;
+      }
+
+      auto& var = vars[id];
+      var.quantization[0] = mode;
+      std::memcpy(&var.quantization[1], &scale, sizeof(scale));
+      std::memcpy(&var.quantization[2], &offset, sizeof(offset));
+      var.isQuantizationChanged = true;
+   }
+
+   // receive only the elements of a var that pass a filter, e.g. (id, IncppectCodec::Greater, 0.5) - see sparse()
+   // the elements are the vars of a wildcard subscription or the elements of an array var
+   void filter(int32_t id, uint32_t op, double a = 0.0, double b = 0.0)
+   {
+      if (id < 0 || id >= int32_t(vars.size())) {
+         return;
+      }
+
+      auto& var = vars[id];
+      var.filter = op;
+      var.filterA = a;
+      var.filterB = b;
+      var.isFilterChanged = true;
+   }
+
+   // elements of a filtered var, by their index in the array or in the layout of the wildcard subscription
+   const std::map<uint32_t, double>& sparse(int32_t id) const { return vars[id].sparse; }
+
+   int32_t nVars() const { return int32_t(vars.size()); }
+
+   const Var& var(int32_t id) const { return vars[id]; }
+
+   // latest data of a var, empty until the first update
+   std::string_view data(int32_t id) const
+   {
+      if (id < 0 || id >= int32_t(vars.size())) {
+         return {};
+      }
+      return {(const char*)(vars[id].buffer.data()), vars[id].size_bytes};
+   }
+
+   template <typename T>
+   std::span<const T> view(int32_t id) const
+   {
+      const auto d = data(id);
+      return {(const T*)(d.data()), d.size() / sizeof(T)};
+   }
+
+   template <typename T>
+   T get(int32_t id, T def = {}) const
+   {
+      const auto d = data(id);
+      if (d.size() < sizeof(T)) {
+         return def;
+      }
+
+      T res;
+      std::memcpy(&res, d.data(), sizeof(T));
+      return res;
+   }
+
+   // values of a float var, dequantized if the service sends it quantized
+   template <typename T>
+   std::vector<T> values(int32_t id) const
+   {
+      std::vector<T> res;
+      const auto d = data(id);
+      const auto& q = vars[id].quantizationApplied;
+      if (q[0] != IncppectCodec::None) {
+         float scale = 0.0f;
+         float offset = 0.0f;
+         std::memcpy(&scale, &q[1], sizeof(scale));
+         std::memcpy(&offset, &q[2], sizeof(offset));
+         IncppectCodec::dequantize(res, d.data(), d.size(), q[0], scale, offset);
+      }
+      else {
+         res.resize(d.size() / sizeof(T));
+         std::memcpy(res.data(), d.data(), res.size() * sizeof(T));
+      }
+
+      return res;
+   }
+
+   // vars of a wildcard subscription, keyed by their concrete path
+   std::map<std::string, std::string_view> batch(int32_t id) const
+   {
+      std::map<std::string, std::string_view> res;
+
+      const auto d = data(id);
+      size_t offset = 0;
+      for (const auto& path : vars[id].layout) {
+         uint32_t size = 0;
+         if (offset + sizeof(size) > d.size()) {
+            break;
+         }
+         std::memcpy(&size, d.data() + offset, sizeof(size));
+         res[path] = d.substr(offset + sizeof(size), size);
+         offset += sizeof(size) + (size + 3) / 4 * 4;
+      }
+
+      return res;
+   }
+
+   // write to a settable var - the writes are sent in a single message by the next poll()
+   // only the last write of a var is kept
+   void set(int32_t id, std::string_view data)
+   {
+      if (id >= 0 && id < int32_t(vars.size())) {
+         writes[id].assign(data.begin(), data.end());
+      }
+   }
+
+   template <typename T>
+      requires(std::is_trivially_copyable_v<T>)
+   void set(int32_t id, const T& value)
+   {
+      set(id, std::string_view((const char*)(&value), sizeof(T)));
+   }
+
+   void onUpdate(TUpdate&& callback) { update = std::move(callback); }
+
+   // ask the service for the registered vars - the callback is invoked from poll() if they changed since the last time
+   void requestSchema()
+   {
+      std::string msg;
+      appendWord(msg, 6);
+      msg.append((const char*)(&schemaHash), sizeof(schemaHash));
+      sendMessage(msg);
+   }
+
+   void onSchema(TSchema&& callback) { schemaUpdate = std::move(callback); }
+
+   const std::vector<SchemaEntry>& schema() const { return schemaEntries; }
+
+   // call a procedure registered with Incppect::rpc() - the response is delivered from poll()
+   void call(std::string_view name, std::string_view payload, TResponse&& response)
+   {
+      const uint32_t callId = nextCallId++;
+      const uint32_t nameLength = uint32_t(name.size());
+
+      std::string msg;
+      appendWord(msg, 5);
+      appendWord(msg, callId);
+      appendWord(msg, nameLength);
+      msg.append(name);
+      msg.append((4 - nameLength % 4) % 4, 0);
+      msg.append(payload);
+
+      if (sendMessage(msg)) {
+         pending[callId] = std::move(response);
+      }
+      else {
+         response(2, "not connected");
+      }
+   }
+
+   // send the pending subscription changes, wait up to `timeout_ms` for data and apply it
+   // returns the number of applied frames, -1 if the connection is closed
+   int32_t poll(int32_t timeout_ms)
+   {
+      if (fd < 0) {
+         return -1;
+      }
+
+      nFrames = 0;
+      sendRequests(false);
+
+      pollfd pfd = {fd, POLLIN, 0};
+      if (::poll(&pfd, 1, timeout_ms) > 0) {
+         if (receive() == false) {
+            disconnect();
+            return -1;
+         }
+      }
+
+      sendRequests(true);
+
+      return nFrames;
+   }
+
+   const Stats& stats() const { return statistics; }
+
+  private:
+   static int64_t timestamp()
+   {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+         .count();
+   }
+
+   static void appendWord(std::string& msg, uint32_t word) { msg.append((const char*)(&word), sizeof(word)); }
+
+   static int connectUnix(const std::string& path)
+   {
+      sockaddr_un addr{};
+      if (path.size() >= sizeof(addr.sun_path)) {
+         return -1;
+      }
+      addr.sun_family = AF_UNIX;
+      std::memcpy(addr.sun_path, path.data(), path.size());
+
+      const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) {
+         return -1;
+      }
+      if (::connect(fd, (const sockaddr*)(&addr), sizeof(addr)) != 0) {
+         ::close(fd);
+         return -1;
+      }
+
+      return fd;
+   }
+
+   static int connectTcp(const std::string& host, const std::string& port)
+   {
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+
+      addrinfo* res = nullptr;
+      if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+         return -1;
+      }
+
+      int fd = -1;
+      for (auto ai = res; ai != nullptr; ai = ai->ai_next) {
+         fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+         if (fd < 0) {
+            continue;
+         }
+         if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+         }
+         ::close(fd);
+         fd = -1;
+      }
+      ::freeaddrinfo(res);
+
+      if (fd >= 0) {
+         const int one = 1;
+         ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+
+      return fd;
+   }
+
+   static std::string base64(const uint8_t* data, size_t n)
+   {
+      static const char* kChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+      std::string res;
+      for (size_t i = 0; i < n; i += 3) {
+         const uint32_t v = (uint32_t(data[i]) << 16) | (i + 1 < n ? uint32_t(data[i + 1]) << 8 : 0) |
+                            (i + 2 < n ? uint32_t(data[i + 2]) : 0);
+         res += kChars[(v >> 18) & 63];
+         res += kChars[(v >> 12) & 63];
+         res += i + 1 < n ? kChars[(v >> 6) & 63] : '=';
+         res += i + 2 < n ? kChars[v & 63] : '=';
+      }
+
+      return res;
+   }
+
+   // http upgrade to websocket - the accept key of the response is not verified
+   bool handshake(const std::string& hostPort, const std::string& path, int32_t timeout_ms)
+   {
+      uint8_t key[16];
+      for (auto& k : key) {
+         k = uint8_t(rng());
+      }
+
+      const std::string request = "GET " + path + " HTTP/1.1\r\n" + "Host: " + hostPort + "\r\n" +
+                                  "Upgrade: websocket\r\n" + "Connection: Upgrade\r\n" +
+                                  "Sec-WebSocket-Key: " + base64(key, sizeof(key)) + "\r\n" +
+                                  "Sec-WebSocket-Version: 13\r\n\r\n";
+      if (sendAll(request) == false) {
+         return false;
+      }
+
+      const auto tStart = timestamp();
+      while (inBuffer.find("\r\n\r\n") == std::string::npos) {
+         const auto tLeft = timeout_ms - (timestamp() - tStart);
+         pollfd pfd = {fd, POLLIN, 0};
+         if (tLeft <= 0 || ::poll(&pfd, 1, int(tLeft)) <= 0) {
+            return false;
+         }
+
+         char buf[1024];
+         const auto n = ::recv(fd, buf, sizeof(buf), 0);
+         if (n <= 0) {
+            return false;
+         }
+         inBuffer.append(buf, size_t(n));
+      }
+
+      const auto end = inBuffer.find("\r\n\r\n") + 4;
+      const bool isOk = inBuffer.rfind("HTTP/1.1 101", 0) == 0;
+      inBuffer.erase(0, end); // anything after the response already belongs to the websocket
+
+      return isOk;
+   }
+
+   bool sendAll(std::string_view data)
+   {
+      while (data.empty() == false) {
+         const auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+         if (n < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+            return false;
+         }
+         data.remove_prefix(size_t(n));
+      }
+
+      return true;
+   }
+
+   bool sendMessage(std::string_view msg, uint8_t opcode = 0x2)
+   {
+      if (fd < 0) {
+         return false;
+      }
+
+      outBuffer.clear();
+      if (isWebSocket) {
+         // client frames are always masked
+         outBuffer += char(0x80 | opcode);
+         if (msg.size() < 126) {
+            outBuffer += char(0x80 | msg.size());
+         }
+         else if (msg.size() < 65536) {
+            outBuffer += char(0x80 | 126);
+            outBuffer += char(msg.size() >> 8);
+            outBuffer += char(msg.size() & 0xff);
+         }
+         else {
+            outBuffer += char(0x80 | 127);
+            for (int i = 7; i >= 0; --i) {
+               outBuffer += char((uint64_t(msg.size()) >> (8 * i)) & 0xff);
+            }
+         }
+
+         const uint32_t mask = uint32_t(rng());
+         const auto maskBytes = (const char*)(&mask);
+         outBuffer.append(maskBytes, sizeof(mask));
+
+         const auto offset = outBuffer.size();
+         outBuffer.append(msg);
+         for (size_t i = 0; i < msg.size(); ++i) {
+            outBuffer[offset + i] ^= maskBytes[i % 4];
+         }
+      }
+      else {
+         appendWord(outBuffer, uint32_t(msg.size()));
+         outBuffer.append(msg);
+      }
+
+      statistics.tx_n += 1;
+      statistics.tx_bytes += msg.size();
+
+      return sendAll(outBuffer);
+   }
+
+   // registrations, subscription changes and rates are sent right away
+   // keepalives and frame acknowledgements at most every tRequestsUpdate_ms
+   void sendRequests(bool isAfterReceive)
+   {
+      std::string msg = "";
+      for (int32_t id = 0; id < int32_t(vars.size()); ++id) {
+         auto& var = vars[id];
+         if (var.isRegistered) {
+            continue;
+         }
+
+         msg += var.path + " " + std::to_string(id) + " " + std::to_string(var.idxs.size()) + " ";
+         for (const auto idx : var.idxs) {
+            msg += std::to_string(idx) + " ";
+         }
+         var.isRegistered = true;
+      }
+      if (msg.empty() == false) {
+         std::string registration;
+         appendWord(registration, 1);
+         registration += msg;
+         registration += '\0';
+         sendMessage(registration);
+      }
+
+      if (writes.empty() == false) {
+         // [13][id][size][data, padded to 4 bytes]...
+         std::string msg;
+         appendWord(msg, 13);
+         for (const auto& [id, data] : writes) {
+            appendWord(msg, id);
+            appendWord(msg, uint32_t(data.size()));
+            msg += data;
+            msg.append((4 - data.size() % 4) % 4, 0);
+         }
+         sendMessage(msg);
+         writes.clear();
+      }
+
+      std::string rates;
+      std::string quantization;
+      std::string filters;
+      std::string added;
+      std::string removed;
+      for (int32_t id = 0; id < int32_t(vars.size()); ++id) {
+         auto& var = vars[id];
+         if (var.isRateChanged) {
+            appendWord(rates, id);
+            appendWord(rates, var.tMinUpdate_ms);
+            appendWord(rates, var.tMaxUpdate_ms);
+            var.isRateChanged = false;
+         }
+         if (var.isQuantizationChanged) {
+            appendWord(quantization, id);
+            quantization.append((const char*)(var.quantization), sizeof(var.quantization));
+            var.isQuantizationChanged = false;
+         }
+         if (var.isFilterChanged) {
+            appendWord(filters, id);
+            appendWord(filters, var.filter);
+            filters.append((const char*)(&var.filterA), sizeof(var.filterA));
+            filters.append((const char*)(&var.filterB), sizeof(var.filterB));
+            var.isFilterChanged = false;
+         }
+         if (var.isActive != var.isActiveSent) {
+            appendWord(var.isActive ? added : removed, id);
+            var.isActiveSent = var.isActive;
+         }
+      }
+
+      const auto tCur = timestamp();
+      const bool isDue = tCur - tLastRequests_ms >= tRequestsUpdate_ms;
+      for (auto& [type, ids] : {std::pair{9u, &rates}, std::pair{14u, &quantization}, std::pair{15u, &filters},
+                                 std::pair{7u, &added}, std::pair{8u, &removed}}) {
+         if (ids->empty() == false) {
+            std::string msg;
+            appendWord(msg, type);
+            msg += *ids;
+            sendMessage(msg);
+            tLastRequests_ms = tCur;
+         }
+      }
+
+      if (isDue && tCur - tLastRequests_ms >= tRequestsUpdate_ms) {
+         std::string keepalive;
+         appendWord(keepalive, 3);
+         sendMessage(keepalive);
+         tLastRequests_ms = tCur;
+      }
+
+      if (needsAck && (isDue || isAfterReceive == false)) {
+         // [seq][frame timestamp][time since the frame was applied, us]
+         const auto tHold_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                  std::chrono::steady_clock::now() - tFrameApplied)
+                                  .count();
+
+         std::string ack;
+         appendWord(ack, 10);
+         appendWord(ack, frameSeq);
+         ack.append((const char*)(&frameTimestamp_us), sizeof(frameTimestamp_us));
+         appendWord(ack, uint32_t(tHold_us));
+         sendMessage(ack);
+         needsAck = false;
+      }
+   }
+
+   // read the available data and handle the complete messages, false if the connection is closed
+   bool receive()
+   {
+      char buf[64 * 1024];
+      while (true) {
+         const auto n = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+         if (n == 0) {
+            return false;
+         }
+         if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+               break;
+            }
+            if (errno == EINTR) {
+               continue;
+            }
+            return false;
+         }
+         inBuffer.append(buf, size_t(n));
+      }
+
+      size_t offset = 0;
+      const bool isOk = isWebSocket ? receiveWebSocket(offset) : receiveLocal(offset);
+      inBuffer.erase(0, offset);
+
+      return isOk;
+   }
+
+   bool receiveLocal(size_t& offset)
+   {
+      while (inBuffer.size() - offset >= sizeof(uint32_t)) {
+         uint32_t size = 0;
+         std::memcpy(&size, inBuffer.data() + offset, sizeof(size));
+         if (size > maxMessage_bytes) {
+            return false;
+         }
+         if (inBuffer.size() - offset - sizeof(size) < size) {
+            break;
+         }
+
+         onMessage({inBuffer.data() + offset + sizeof(size), size});
+         offset += sizeof(size) + size;
+      }
+
+      return true;
+   }
+
+   bool receiveWebSocket(size_t& offset)
+   {
+      while (inBuffer.size() - offset >= 2) {
+         const auto header = (const uint8_t*)(inBuffer.data() + offset);
+         const bool isFinal = header[0] & 0x80;
+         const uint8_t opcode = header[0] & 0x0f;
+         const bool isMasked = header[1] & 0x80;
+
+         size_t headerSize = 2;
+         uint64_t size = header[1] & 0x7f;
+         if (size == 126 || size == 127) {
+            const size_t nBytes = size == 126 ? 2 : 8;
+            if (inBuffer.size() - offset < 2 + nBytes) {
+               break;
+            }
+            size = 0;
+            for (size_t i = 0; i < nBytes; ++i) {
+               size = (size << 8) | header[2 + i];
+            }
+            headerSize += nBytes;
+         }
+         if (size > maxMessage_bytes) {
+            return false;
+         }
+         headerSize += isMasked ? 4 : 0;
+         if (inBuffer.size() - offset < headerSize + size) {
+            break;
+         }
+
+         char* payload = inBuffer.data() + offset + headerSize;
+         if (isMasked) {
+            const char* mask = payload - 4;
+            for (size_t i = 0; i < size; ++i) {
+               payload[i] ^= mask[i % 4];
+            }
+         }
+         const std::string_view data(payload, size);
+         offset += headerSize + size;
+
+         switch (opcode) {
+         case 0x0: // continuation
+         case 0x1: // text
+         case 0x2: // binary
+            // unfragmented messages are handed over in place, only fragments are collected
+            if (isFinal && fragments.empty() && opcode != 0x0) {
+               onMessage(data);
+            }
+            else {
+               fragments.append(data);
+               if (fragments.size() > maxMessage_bytes) {
+                  return false;
+               }
+               if (isFinal) {
+                  onMessage(fragments);
+                  fragments.clear();
+               }
+            }
+            break;
+         case 0x8: // close
+            return false;
+         case 0x9: // ping
+            sendMessage(data, 0xa);
+            break;
+         default:
+            break;
+         }
+      }
+
+      return true;
+   }
+
+   void onMessage(std::string_view msg)
+   {
+      statistics.rx_n += 1;
+      statistics.rx_bytes += msg.size();
+
+      uint32_t typeAll = 0;
+      if (msg.size() < sizeof(typeAll)) {
+         return;
+      }
+      std::memcpy(&typeAll, msg.data(), sizeof(typeAll));
+
+      switch (typeAll) {
+      case IncppectCodec::RpcResponse: {
+         // [callId][status][payload]
+         uint32_t header[3] = {};
+         if (msg.size() < sizeof(header)) {
+            return;
+         }
+         std::memcpy(header, msg.data(), sizeof(header));
+
+         if (auto it = pending.find(header[1]); it != pending.end()) {
+            auto response = std::move(it->second);
+            pending.erase(it);
+            response(header[2], msg.substr(sizeof(header)));
+         }
+      } break;
+      case IncppectCodec::Schema: {
+         applySchema(msg);
+      } break;
+      case IncppectCodec::Quantization: {
+         // [requestId][mode][scale][offset]...
+         for (size_t k = sizeof(uint32_t); k + 4 * sizeof(uint32_t) <= msg.size(); k += 4 * sizeof(uint32_t)) {
+            int32_t id = -1;
+            std::memcpy(&id, msg.data() + k, sizeof(id));
+            if (id >= 0 && id < int32_t(vars.size())) {
+               std::memcpy(vars[id].quantizationApplied, msg.data() + k + sizeof(id),
+                           sizeof(vars[id].quantizationApplied));
+            }
+         }
+      } break;
+      case IncppectCodec::Frame:
+      case IncppectCodec::FrameDelta:
+      case IncppectCodec::Keyframe: {
+         onFrame(typeAll, msg);
+      } break;
+      default:
+         break;
+      }
+   }
+
+   // [typeAll][hash, 8 bytes][count]
+   // [pathLength][type, endianness, ndims, flags][dims, ndims x 4 bytes][path, padded to 4 bytes]...
+   void applySchema(std::string_view msg)
+   {
+      uint32_t count = 0;
+      if (msg.size() < sizeof(uint32_t) + sizeof(schemaHash) + sizeof(count)) {
+         return;
+      }
+      std::memcpy(&schemaHash, msg.data() + sizeof(uint32_t), sizeof(schemaHash));
+      std::memcpy(&count, msg.data() + sizeof(uint32_t) + sizeof(schemaHash), sizeof(count));
+
+      schemaEntries.clear();
+      size_t offset = sizeof(uint32_t) + sizeof(schemaHash) + sizeof(count);
+      for (uint32_t i = 0; i < count && offset + 2 * sizeof(uint32_t) <= msg.size(); ++i) {
+         uint32_t pathLength = 0;
+         uint8_t info[4] = {};
+         std::memcpy(&pathLength, msg.data() + offset, sizeof(pathLength));
+         std::memcpy(info, msg.data() + offset + sizeof(pathLength), sizeof(info));
+         offset += sizeof(pathLength) + sizeof(info);
+
+         const size_t nShape_bytes = info[2] * sizeof(int32_t);
+         if (offset + nShape_bytes + pathLength > msg.size()) {
+            break;
+         }
+
+         auto& entry = schemaEntries.emplace_back();
+         entry.type = info[0];
+         entry.endianness = info[1];
+         entry.isSettable = (info[3] & 1) != 0;
+         entry.shape.resize(info[2]);
+         std::memcpy(entry.shape.data(), msg.data() + offset, nShape_bytes);
+         entry.path.assign(msg.data() + offset + nShape_bytes, pathLength);
+         offset += nShape_bytes + (size_t(pathLength) + 3) / 4 * 4;
+      }
+
+      if (schemaUpdate) {
+         schemaUpdate(schemaEntries);
+      }
+   }
+
+   void onFrame(uint32_t typeAll, std::string_view msg)
+   {
+      constexpr auto kHeader_bytes = IncppectCodec::kFrameHeader_bytes;
+      if (msg.size() < kHeader_bytes || msg.size() % sizeof(uint32_t) != 0) {
+         return;
+      }
+
+      uint32_t header[4] = {};
+      std::memcpy(header, msg.data(), sizeof(header));
+
+      if (typeAll == IncppectCodec::Keyframe) {
+         keyframePending = false;
+         statistics.keyframes += 1;
+      }
+      else if (keyframePending == false) {
+         // frames other than keyframes can contain deltas against the previous frame
+         uint32_t base = header[1] - 1;
+         if (typeAll == IncppectCodec::FrameDelta && msg.size() >= kHeader_bytes + sizeof(base)) {
+            std::memcpy(&base, msg.data() + kHeader_bytes, sizeof(base));
+         }
+         if (frame.empty() || base != frameSeq) {
+            statistics.seq_gaps += 1;
+            requestKeyframe();
+         }
+      }
+
+      if (keyframePending) {
+         return;
+      }
+
+      if (typeAll == IncppectCodec::FrameDelta) {
+         const auto runs = msg.substr(kHeader_bytes + sizeof(uint32_t));
+         const size_t nWords = frame.size() - kHeader_bytes / 4;
+         if (IncppectCodec::applyXorRle(runs.data(), runs.size() / 8, frame.data() + kHeader_bytes / 4, nWords) !=
+             nWords) {
+            statistics.seq_gaps += 1;
+            requestKeyframe();
+            return;
+         }
+         std::memcpy(frame.data(), header, sizeof(header));
+      }
+      else {
+         frame.resize(msg.size() / sizeof(uint32_t));
+         std::memcpy(frame.data(), msg.data(), msg.size());
+      }
+
+      frameSeq = header[1];
+      std::memcpy(&frameTimestamp_us, &header[2], sizeof(frameTimestamp_us));
+      tFrameApplied = std::chrono::steady_clock::now();
+      needsAck = true;
+
+      applyRecords();
+
+      statistics.frames += 1;
+      ++nFrames;
+   }
+
+   // the state can only be recovered from a keyframe
+   void requestKeyframe()
+   {
+      if (keyframePending) {
+         return;
+      }
+      keyframePending = true;
+
+      std::string request;
+      appendWord(request, 11);
+      sendMessage(request);
+   }
+
+   // the small vars are packed into a single record, described by the last layout record
+   // returns false if the record does not match the layout
+   bool applyBundle(int32_t type, const char* payload, uint32_t size)
+   {
+      if (type == IncppectCodec::BundleLayout) {
+         // [count][requestId, size]...
+         uint32_t count = 0;
+         if (size < sizeof(count)) {
+            return false;
+         }
+         std::memcpy(&count, payload, sizeof(count));
+         count = std::min<uint32_t>(count, (size - uint32_t(sizeof(count))) / 8);
+
+         bundleLayout.resize(2 * size_t(count));
+         std::memcpy(bundleLayout.data(), payload + sizeof(count), bundleLayout.size() * sizeof(uint32_t));
+         return true;
+      }
+
+      // the data of the vars in the layout, each padded to 4 bytes
+      size_t offset = 0;
+      for (size_t i = 0; i + 1 < bundleLayout.size(); i += 2) {
+         const int32_t id = int32_t(bundleLayout[i]);
+         const uint32_t memberSize = bundleLayout[i + 1];
+         if (offset + memberSize > size || id < 0 || id >= int32_t(vars.size())) {
+            return false;
+         }
+
+         {
+            auto& var = vars[id];
+            var.buffer.resize((size_t(memberSize) + 3) / 4);
+            std::memcpy(var.buffer.data(), payload + offset, memberSize);
+            var.size_bytes = memberSize;
+            var.seq = frameSeq;
+            if (update) {
+               update(id, data(id));
+            }
+         }
+         offset += memberSize;
+      }
+
+      return true;
+   }
+
+   void applyRecords()
+   {
+      const auto words = frame.data();
+      const size_t nWords = frame.size();
+
+      size_t offset = IncppectCodec::kFrameHeader_bytes / 4;
+      while (offset + 3 <= nWords) {
+         const int32_t id = int32_t(words[offset + 0]);
+         const int32_t type = int32_t(words[offset + 1]);
+         const uint32_t size = words[offset + 2];
+         offset += 3;
+
+         const size_t nPayload = (size_t(size) + 3) / 4;
+         if (offset + nPayload > nWords) {
+            break;
+         }
+
+         const auto payload = (const char*)(words + offset);
+         offset += nPayload;
+
+         // a record that cannot be applied leaves its var out of step with the next deltas
+         if (type == IncppectCodec::BundleLayout || type == IncppectCodec::Bundle) {
+            if (applyBundle(type, payload, size) == false) {
+               statistics.record_errors += 1;
+               requestKeyframe();
+            }
+            continue;
+         }
+
+         if (id < 0 || id >= int32_t(vars.size())) {
+            statistics.record_errors += 1;
+            requestKeyframe();
+            continue;
+         }
+         auto& var = vars[id];
+
+         bool isApplied = true;
+         bool isComplete = true;
+         switch (type) {
+         case IncppectCodec::Full: {
+            var.buffer.resize(nPayload);
+            std::memcpy(var.buffer.data(), payload, size);
+            var.size_bytes = size;
+         } break;
+         case IncppectCodec::Delta: {
+            isApplied = IncppectCodec::applyXorRle(payload, size / 8, var.buffer.data(), var.buffer.size()) ==
+                        var.buffer.size();
+         } break;
+         case IncppectCodec::Tiles: {
+            isApplied = IncppectCodec::applyTiles(payload, size, (char*)(var.buffer.data()), var.size_bytes, tile);
+         } break;
+         case IncppectCodec::Sparse: {
+            isApplied = IncppectCodec::applySparse(payload, size, var.sparse);
+         } break;
+         case IncppectCodec::Chunk:
+         case IncppectCodec::ChunkDelta: {
+            // [total size][offset][payload]
+            uint32_t chunk[2] = {};
+            if (size < sizeof(chunk)) {
+               isApplied = false;
+               break;
+            }
+            std::memcpy(chunk, payload, sizeof(chunk));
+            const uint32_t total = chunk[0];
+            const uint32_t chunkOffset = chunk[1];
+            const uint32_t chunkSize = size - uint32_t(sizeof(chunk));
+            if (chunkOffset % 4 != 0 || chunkOffset > total ||
+                (type == IncppectCodec::Chunk && chunkSize > total - chunkOffset)) {
+               isApplied = false;
+               break;
+            }
+
+            if (var.size_bytes != total) {
+               var.buffer.assign((size_t(total) + 3) / 4, 0);
+               var.size_bytes = total;
+            }
+
+            if (type == IncppectCodec::Chunk) {
+               std::memcpy((char*)(var.buffer.data()) + chunkOffset, payload + sizeof(chunk), chunkSize);
+               isComplete = chunkOffset + chunkSize >= total;
+            }
+            else {
+               const size_t nWords = var.buffer.size() - chunkOffset / 4;
+               const size_t nCovered = IncppectCodec::applyXorRle(payload + sizeof(chunk), chunkSize / 8,
+                                                                  var.buffer.data() + chunkOffset / 4, nWords);
+               isApplied = nCovered <= nWords;
+               isComplete = chunkOffset + 4 * nCovered >= total;
+            }
+         } break;
+         case IncppectCodec::BatchLayout: {
+            // [count][pathLength][path, padded to 4 bytes]...
+            uint32_t count = 0;
+            std::memcpy(&count, payload, std::min<size_t>(size, sizeof(count)));
+
+            var.layout.clear();
+            size_t k = sizeof(count);
+            for (uint32_t i = 0; i < count && k + sizeof(uint32_t) <= size; ++i) {
+               uint32_t pathLength = 0;
+               std::memcpy(&pathLength, payload + k, sizeof(pathLength));
+               k += sizeof(pathLength);
+               var.layout.emplace_back(payload + k, std::min<size_t>(pathLength, size - k));
+               k += (size_t(pathLength) + 3) / 4 * 4;
+            }
+            continue;
+         }
+         default:
+            continue;
+         }
+
+         if (isApplied == false) {
+            statistics.record_errors += 1;
+            requestKeyframe();
+            continue;
+         }
+
+         if (isComplete) {
+            var.seq = frameSeq;
+            if (update) {
+               update(id, data(id));
+            }
+         }
+      }
+   }
+
+   int fd = -1;
+   bool isWebSocket = true;
+
+   std::string inBuffer{};
+   std::string outBuffer{};
+   std::string fragments{};
+
+   // [requestId, size]... of the vars in the bundle
+   std::vector<uint32_t> bundleLayout{};
+
+   // scratch buffer for the tiles of image vars
+   std::vector<uint32_t> tile{};
+
+   // last applied frame - whole-frame deltas are applied on top of it
+   std::vector<uint32_t> frame{};
+   uint32_t frameSeq = 0;
+   int64_t frameTimestamp_us = 0;
+   std::chrono::steady_clock::time_point tFrameApplied{};
+   bool keyframePending = false;
+   bool needsAck = false;
+   int32_t nFrames = 0;
+
+   int64_t tLastRequests_ms = 0;
+
+   std::vector<Var> vars{};
+   std::map<std::pair<std::string, std::vector<int>>, int32_t> ids{};
+   std::map<int32_t, std::string> writes{};
+
+   uint32_t nextCallId = 1;
+   std::map<uint32_t, TResponse> pending{};
+
+   TUpdate update{};
+   Stats statistics{};
+
+   uint64_t schemaHash = 0;
+   std::vector<SchemaEntry> schemaEntries{};
+   TSchema schemaUpdate{};
+
+   std::mt19937 rng{std::random_device{}()};
+};
@@ -0,0 +1,461 @@
+/*! \file codec.h
+ *  \brief Frame format and delta encoding shared by the incppect service and the native client.
+ *  \author Georgi Gerganov
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Frames sent by the service:
+//
+//   [typeAll][seq][timestamp in us, 8 bytes][records]
+//
+// Records:
+//
+//   [requestId][type][size][payload, padded to 4 bytes]
+//
+// Deltas are the XOR of the 4-byte words of the previous and the current data, encoded as (count, value) runs.
+//
+// Deltas of 2D buffers (images) are the tiles that changed:
+//
+//   [width][height][format][pixel size][tile size][count]
+//   [tile index][encoding][size][data, padded to 4 bytes]...
+//
+// Filtered requests are sent as the elements that pass the filter, as changes to the previously sent set:
+//
+//   [flags][nRemoved][nSet][removed indices][set indices][set values, float64]
+//
+// flags: bit 0 - the set replaces the previous one, bit 1 - the set was truncated to fit in a chunk
+//
+// The tiles are numbered row by row and their data holds the rows of the tile, clipped at the edges of the image,
+// back to back. The tiles are encoded as the pixels (TileEncoding::Raw) or as the XOR-RLE of the previous and the
+// current pixels (TileEncoding::XorRle), whichever is smaller.
+struct IncppectCodec
+{
+   static constexpr uint32_t kFrameHeader_bytes = 4 * sizeof(uint32_t);
+   static constexpr uint32_t kRecordHeader_bytes = 3 * sizeof(uint32_t);
+
+   // typeAll - the first word of every message sent by the service
+   enum MessageType : uint32_t {
+      Frame = 0,
+      FrameDelta = 1, // [header][base seq][xor-rle of the records of frame `base seq`]
+      RpcResponse = 2,
+      Schema = 3,
+      Keyframe = 4,
+      Session = 5,      // [token, 8 bytes][resumed]
+      Quantization = 6, // [requestId][mode][scale][offset]... as applied by the service
+   };
+
+   // type of a record
+   enum RecordType : int32_t {
+      Full = 0,
+      Delta = 1,
+      Chunk = 2,      // [total size][offset][payload]
+      ChunkDelta = 3, // [total size][offset][xor-rle of the payload]
+      BatchLayout = 4,
+      BundleLayout = 5, // [count][requestId, padded size]...
+      Bundle = 6,       // [data of the requests in the layout, each padded to 4 bytes]
+      Tiles = 7,
+      Sparse = 8,
+   };
+
+   // filter of the elements of a request: element `op` a, or a <= element < b for Between
+   enum FilterOp : uint32_t {
+      NoFilter = 0,
+      Greater = 1,
+      GreaterEqual = 2,
+      Less = 3,
+      LessEqual = 4,
+      Equal = 5,
+      NotEqual = 6,
+      AbsGreater = 7,
+      Between = 8,
+   };
+
+   enum SparseFlags : uint32_t {
+      SparseFull = 1,
+      SparseTruncated = 2,
+   };
+
+   static bool passes(uint32_t op, double v, double a, double b)
+   {
+      switch (op) {
+      case Greater:
+         return v > a;
+      case GreaterEqual:
+         return v >= a;
+      case Less:
+         return v < a;
+      case LessEqual:
+         return v <= a;
+      case Equal:
+         return v == a;
+      case NotEqual:
+         return v != a;
+      case AbsGreater:
+         return std::abs(v) > a;
+      case Between:
+         return v >= a && v < b;
+      default:
+         return true;
+      }
+   }
+
+   enum TileEncoding : uint32_t {
+      Raw = 0,
+      XorRle = 1,
+   };
+
+   // lossy encoding of float vars, requested per subscription
+   //
+   //   Int8, Int16 - round((v - offset) / scale), saturated
+   //   Fixed       - float32 of offset + round((v - offset) / scale) * scale
+   //
+   // non-finite values are sent as 0 by the integer modes
+   //
+   // the quantized data is [element count][values], since the padding of the records would otherwise read as
+   // additional elements of the 1 and 2 byte modes
+   enum QuantizationMode : uint32_t {
+      None = 0,
+      Int8 = 1,
+      Int16 = 2,
+      Fixed = 3,
+   };
+
+   static constexpr uint32_t quantizedSize(uint32_t mode) { return mode == Int8 ? 1 : mode == Int16 ? 2 : 4; }
+
+   // quantize the float32 (or float64 if `isDouble`) values in `src` into `dst`
+   static void quantize(std::string& dst, const char* src, size_t src_bytes, bool isDouble, uint32_t mode, float scale,
+                        float offset)
+   {
+      const uint32_t n = uint32_t(src_bytes / (isDouble ? sizeof(double) : sizeof(float)));
+      const size_t size = quantizedSize(mode);
+      dst.resize(sizeof(n) + n * size);
+      std::memcpy(dst.data(), &n, sizeof(n));
+
+      const double inv = 1.0 / double(scale);
+      char* values = dst.data() + sizeof(n);
+      for (size_t i = 0; i < n; ++i) {
+         double v = 0.0;
+         if (isDouble) {
+            std::memcpy(&v, src + i * sizeof(double), sizeof(double));
+         }
+         else {
+            float f = 0.0f;
+            std::memcpy(&f, src + i * sizeof(float), sizeof(float));
+            v = f;
+         }
+
+         const double q = std::round((v - offset) * inv);
+         if (mode == Fixed) {
+            const float f = std::isfinite(q) ? float(offset + q * scale) : float(v);
+            std::memcpy(values + i * size, &f, sizeof(f));
+         }
+         else if (mode == Int16) {
+            const int16_t x = std::isfinite(q) ? int16_t(std::clamp(q, -32768.0, 32767.0)) : 0;
+            std::memcpy(values + i * size, &x, sizeof(x));
+         }
+         else {
+            const int8_t x = std::isfinite(q) ? int8_t(std::clamp(q, -128.0, 127.0)) : 0;
+            std::memcpy(values + i * size, &x, sizeof(x));
+         }
+      }
+   }
+
+   // values of quantized data
+   template <typename T>
+   static void dequantize(std::vector<T>& dst, const char* src, size_t src_bytes, uint32_t mode, float scale,
+                          float offset)
+   {
+      uint32_t n = 0;
+      if (src_bytes < sizeof(n)) {
+         dst.clear();
+         return;
+      }
+      std::memcpy(&n, src, sizeof(n));
+      src += sizeof(n);
+
+      const size_t size = quantizedSize(mode);
+      dst.resize(std::min<size_t>(n, (src_bytes - sizeof(n)) / size));
+      for (size_t i = 0; i < dst.size(); ++i) {
+         if (mode == Fixed) {
+            float f = 0.0f;
+            std::memcpy(&f, src + i * size, sizeof(f));
+            dst[i] = T(f);
+         }
+         else if (mode == Int16) {
+            int16_t x = 0;
+            std::memcpy(&x, src + i * size, sizeof(x));
+            dst[i] = T(offset + double(x) * scale);
+         }
+         else {
+            int8_t x = 0;
+            std::memcpy(&x, src + i * size, sizeof(x));
+            dst[i] = T(offset + double(x) * scale);
+         }
+      }
+   }
+
+   static constexpr uint32_t kTilesHeader_bytes = 6 * sizeof(uint32_t);
+   static constexpr uint32_t kTileHeader_bytes = 3 * sizeof(uint32_t);
+
+   // geometry of a 2D buffer
+   struct Image
+   {
+      uint32_t width = 0;
+      uint32_t height = 0;
+      uint32_t format = 0; // opaque to the codec
+      uint32_t pixelSize = 0;
+      uint32_t tileSize = 0;
+
+      // computed in 64 bits, since the geometry of received tiles is not trusted
+      uint64_t size_bytes() const { return uint64_t(width) * height * pixelSize; }
+      uint64_t nTilesX() const { return (uint64_t(width) + tileSize - 1) / tileSize; }
+      uint64_t nTilesY() const { return (uint64_t(height) + tileSize - 1) / tileSize; }
+
+      // the tiles fit in the image, the size does not overflow and the tiles can be indexed with 32 bits
+      bool isValid() const
+      {
+         if (width == 0 || height == 0 || pixelSize == 0 || tileSize == 0) {
+            return false;
+         }
+         if (tileSize > width || tileSize > height) {
+            return false;
+         }
+         if (uint64_t(width) * height > UINT64_MAX / pixelSize) {
+            return false;
+         }
+         return nTilesX() * nTilesY() <= UINT32_MAX;
+      }
+   };
+
+   // append the XOR of the 4-byte words of `prev` and `cur` to `dst` as (count, value) runs
+   // `cur` holds `n` valid bytes - the trailing partial word is zero-extended
+   // `prev` must hold at least `n` bytes rounded up to a multiple of 4
+   static void encodeXorRle(std::string& dst, const char* prev, const char* cur, size_t n)
+   {
+      uint32_t a = 0;
+      uint32_t b = 0;
+      uint32_t c = 0;
+      uint32_t k = 0;
+
+      constexpr auto chunk_size = sizeof(uint32_t);
+      for (size_t i = 0; i < n; i += chunk_size) {
+         const size_t m = std::min(chunk_size, n - i);
+         a = 0;
+         b = 0;
+         std::memcpy(&a, prev + i, m);
+         std::memcpy(&b, cur + i, m);
+         a ^= b;
+         if (a == c) {
+            ++k;
+         }
+         else {
+            if (k > 0) {
+               dst.append((char*)(&k), sizeof(k));
+               dst.append((char*)(&c), sizeof(c));
+            }
+            k = 1;
+            c = a;
+         }
+      }
+
+      if (k > 0) {
+         dst.append((char*)(&k), sizeof(k));
+         dst.append((char*)(&c), sizeof(c));
+      }
+   }
+
+   // append the tiles of `cur` that differ from `prev` to `dst`
+   // `prev` and `cur` hold image.size_bytes() bytes, `tilePrev` and `tileCur` are scratch buffers
+   // returns false, leaving `dst` unchanged, once the encoded tiles would exceed `max_bytes`
+   static bool encodeTiles(std::string& dst, const char* prev, const char* cur, const Image& image, size_t max_bytes,
+                           std::string& tilePrev, std::string& tileCur)
+   {
+      const auto size0 = dst.size();
+      const uint32_t header[6] = {image.width, image.height, image.format, image.pixelSize, image.tileSize, 0};
+      dst.append((const char*)(header), sizeof(header));
+
+      uint32_t count = 0;
+      const size_t stride = size_t(image.width) * image.pixelSize;
+      for (uint64_t ty = 0; ty < image.nTilesY(); ++ty) {
+         const uint64_t y0 = ty * image.tileSize;
+         const uint64_t y1 = std::min<uint64_t>(y0 + image.tileSize, image.height);
+         for (uint64_t tx = 0; tx < image.nTilesX(); ++tx) {
+            const uint64_t x0 = tx * image.tileSize;
+            const size_t row_bytes = size_t(std::min<uint64_t>(image.tileSize, image.width - x0)) * image.pixelSize;
+            const size_t offset = size_t(x0) * image.pixelSize;
+
+            bool isDirty = false;
+            for (uint64_t y = y0; y < y1 && isDirty == false; ++y) {
+               isDirty = std::memcmp(prev + y * stride + offset, cur + y * stride + offset, row_bytes) != 0;
+            }
+            if (isDirty == false) {
+               continue;
+            }
+
+            const size_t n = row_bytes * (y1 - y0);
+            const size_t padded = (n + 3) / 4 * 4;
+            tilePrev.assign(padded, 0);
+            tileCur.assign(padded, 0);
+            for (uint64_t y = y0; y < y1; ++y) {
+               std::memcpy(tilePrev.data() + (y - y0) * row_bytes, prev + y * stride + offset, row_bytes);
+               std::memcpy(tileCur.data() + (y - y0) * row_bytes, cur + y * stride + offset, row_bytes);
+            }
+
+            const uint32_t index = uint32_t(ty * image.nTilesX() + tx);
+            const auto tile0 = dst.size();
+            uint32_t tile[3] = {index, XorRle, 0};
+            dst.append((const char*)(tile), sizeof(tile));
+            encodeXorRle(dst, tilePrev.data(), tileCur.data(), n);
+            if (dst.size() - tile0 - sizeof(tile) >= padded) {
+               dst.resize(tile0 + sizeof(tile));
+               dst.append(tileCur);
+               tile[1] = Raw;
+            }
+            tile[2] = uint32_t(dst.size() - tile0 - sizeof(tile));
+            std::memcpy(dst.data() + tile0, tile, sizeof(tile));
+
+            if (dst.size() - size0 > max_bytes) {
+               dst.resize(size0);
+               return false;
+            }
+            ++count;
+         }
+      }
+
+      std::memcpy(dst.data() + size0 + 5 * sizeof(uint32_t), &count, sizeof(count));
+      return true;
+   }
+
+   // apply the tiles in `src` to the image in `dst`, which holds `dst_bytes` bytes
+   // `tile` is a scratch buffer. returns false if the tiles do not match the image
+   static bool applyTiles(const char* src, size_t src_bytes, char* dst, size_t dst_bytes, std::vector<uint32_t>& tile)
+   {
+      uint32_t header[6] = {};
+      if (src_bytes < sizeof(header)) {
+         return false;
+      }
+      std::memcpy(header, src, sizeof(header));
+
+      const Image image = {header[0], header[1], header[2], header[3], header[4]};
+      if (image.isValid() == false || image.size_bytes() > dst_bytes) {
+         return false;
+      }
+
+      const size_t stride = size_t(image.width) * image.pixelSize;
+      size_t k = sizeof(header);
+      for (uint32_t i = 0; i < header[5]; ++i) {
+         if (kTileHeader_bytes > src_bytes - k) {
+            return false;
+         }
+         uint32_t h[3] = {};
+         std::memcpy(h, src + k, sizeof(h));
+         k += sizeof(h);
+         if (h[2] > src_bytes - k || h[0] >= image.nTilesX() * image.nTilesY()) {
+            return false;
+         }
+
+         const uint64_t x0 = h[0] % image.nTilesX() * image.tileSize;
+         const uint64_t y0 = h[0] / image.nTilesX() * image.tileSize;
+         const uint64_t y1 = std::min<uint64_t>(y0 + image.tileSize, image.height);
+         const size_t row_bytes = size_t(std::min<uint64_t>(image.tileSize, image.width - x0)) * image.pixelSize;
+         const size_t offset = size_t(x0) * image.pixelSize;
+         const size_t n = row_bytes * (y1 - y0);
+
+         // the rows are increasing, so the last one bounds all of them
+         if (y1 <= y0 || (y1 - 1) * stride + offset + row_bytes > dst_bytes) {
+            return false;
+         }
+
+         tile.assign((n + 3) / 4, 0);
+         auto bytes = (char*)(tile.data());
+         if (h[1] == XorRle) {
+            for (uint64_t y = y0; y < y1; ++y) {
+               std::memcpy(bytes + (y - y0) * row_bytes, dst + y * stride + offset, row_bytes);
+            }
+            applyXorRle(src + k, h[2] / 8, tile.data(), tile.size());
+         }
+         else {
+            std::memcpy(bytes, src + k, std::min<size_t>(n, h[2]));
+         }
+
+         for (uint64_t y = y0; y < y1; ++y) {
+            std::memcpy(dst + y * stride + offset, bytes + (y - y0) * row_bytes, row_bytes);
+         }
+         k += std::min<size_t>((size_t(h[2]) + 3) / 4 * 4, src_bytes - k);
+      }
+
+      return true;
+   }
+
+   // apply a sparse record to the set of (index, value) elements
+   // returns false, leaving the set unchanged, if the record is truncated
+   template <class TMap>
+   static bool applySparse(const char* src, size_t src_bytes, TMap& elements)
+   {
+      uint32_t header[3] = {};
+      if (src_bytes < sizeof(header)) {
+         return false;
+      }
+      std::memcpy(header, src, sizeof(header));
+
+      const size_t nRemoved = header[1];
+      const size_t nSet = header[2];
+      if (sizeof(header) + 4 * (nRemoved + nSet) + 8 * nSet > src_bytes) {
+         return false;
+      }
+
+      if (header[0] & SparseFull) {
+         elements.clear();
+      }
+
+      const char* removed = src + sizeof(header);
+      const char* indices = removed + 4 * nRemoved;
+      const char* values = indices + 4 * nSet;
+      for (size_t i = 0; i < nRemoved; ++i) {
+         uint32_t index = 0;
+         std::memcpy(&index, removed + 4 * i, sizeof(index));
+         elements.erase(index);
+      }
+      for (size_t i = 0; i < nSet; ++i) {
+         uint32_t index = 0;
+         double value = 0.0;
+         std::memcpy(&index, indices + 4 * i, sizeof(index));
+         std::memcpy(&value, values + 8 * i, sizeof(value));
+         elements[index] = value;
+      }
+
+      return true;
+   }
+
+   // xor `nPairs` (count, value) runs from `src` into the `nWords` words of `dst`
+   // runs of zeros are skipped and runs past the end of `dst` are clipped
+   // returns the number of words covered by the runs, larger than nWords if they were clipped
+   static size_t applyXorRle(const char* src, size_t nPairs, uint32_t* dst, size_t nWords)
+   {
+      size_t nCovered = 0;
+      for (size_t i = 0; i < nPairs; ++i) {
+         uint32_t run[2] = {};
+         std::memcpy(run, src + i * sizeof(run), sizeof(run));
+
+         const size_t begin = std::min(nCovered, nWords);
+         nCovered += run[0];
+         const size_t end = std::min(nCovered, nWords);
+         if (run[1] != 0) {
+            for (size_t k = begin; k < end; ++k) {
+               dst[k] ^= run[1];
+            }
+         }
+      }
+
+      return nCovered;
+   }
+};
@@ -8,26 +8,87 @@
 // the main js module
 constexpr auto kIncppect_js = R"js(
 
-var incppect = {
+// create an independent client - every client has its own connection, vars and cached schema, so a page can talk to
+// several incppect instances at once:
+//
+//   var slow = incppect.create({ route: '/slow' });
+//   slow.init();
+//
+var incppect_create = function(config) { return Object.assign({
     // websocket data
     ws: null,
 
-    // default ws url - change to fit your needs
-    ws_uri: 'ws://' + window.location.hostname + ':' + window.location.port + '/incppect',
+    // route of the incppect instance on the server, see Parameters::route
+    route: '/incppect',
+
+    // ws url - by default the route on the host and port of the page
+    ws_uri: null,
 
     // vars data
     nvars: 0,
     vars_map: {},
     var_to_id: {},
     id_to_var: {},
+    batch_layouts: {},
+    bundle_layout: [],
+    views: new WeakMap(),
     last_data: null,
 
+    // image vars: path -> { width, height, format, rgba, dirty }
+    // dirty - [x0, y0, x1, y1] of the pixels updated since the last blit, true for the whole image
+    images: {},
+
+    // optional WebAssembly SIMD decoder for large deltas
+    wasm: null,
+
+    // type metadata of the server vars, keyed by path with '[%d]' indices
+    schema: {},
+    schema_hash: [0, 0],
+
     // requests data
-    requests: [],
-    requests_old: [],
+    requests: new Set(),
+    requests_active: new Set(),
     requests_new_vars: false,
+    nvars_registered: 0,
     requests_regenerate: true,
 
+    // update rates: path -> [min interval ms, max interval ms]
+    rates: {},
+    rates_changed: false,
+
+    // quantization: path -> [mode, scale, offset], as requested and as applied by the server
+    // the float views of quantized vars are dequantized copies, refreshed once per frame
+    quantization: {},
+    quantization_changed: false,
+    quantization_applied: {},
+    dequantized: {},
+
+    // filters: path -> [op, a, b]. filtered vars are received as a Map of index -> value, see get_sparse()
+    filters: {},
+    filters_changed: false,
+    sparse: {},
+
+    // last applied frame: [seq, timestamp lo, timestamp hi], acknowledged to the server for latency tracking
+    frame_header: [0, 0, 0],
+    frame_seq_acked: 0,
+    t_frame_applied_ms: null,
+
+    // set when a delta could not be applied - frames are dropped until the requested keyframe arrives
+    keyframe_pending: false,
+
+    // session issued by the server: [token lo, token hi]
+    // a reconnect within the grace period of the server resumes it, keeping the registered vars and the delta state
+    session: null,
+    session_pending: false,
+    t_session_request_ms: null,
+
+    // writes to settable vars that are not sent yet: path -> bytes, only the last write of a var is kept
+    writes: new Map(),
+
+    // rpc data
+    rpc_next_id: 1,
+    rpc_pending: {},
+
     // timestamps
     t_start_ms: null,
     t_frame_begin_ms: null,
@@ -37,6 +98,8 @@ var incppect = {
     k_var_delim: ' ',
     k_auto_reconnect: true,
     k_requests_update_freq_ms: 50,
+    k_session_timeout_ms: 1000,
+    k_wasm_min_words: 16384,
 
     // stats
     stats: {
@@ -45,6 +108,9 @@ var incppect = {
 
         rx_n: 0,
         rx_bytes: 0,
+
+        seq_gaps: 0,
+        record_errors: 0,
     },
 
     timestamp: function() {
@@ -53,19 +119,32 @@ var incppect = {
           : Date.now();
       },
 
+    create: function(config) {
+        return incppect_create(config);
+    },
+
+    get_ws_uri: function() {
+        if (this.ws_uri !== null) {
+            return this.ws_uri;
+        }
+        return 'ws://' + window.location.hostname + ':' + window.location.port + this.route;
+    },
+
     init: function() {
         var onopen = this.onopen.bind(this);
         var onclose = this.onclose.bind(this);
         var onmessage = this.onmessage.bind(this);
         var onerror = this.onerror.bind(this);
 
-        this.ws = new WebSocket(this.ws_uri);
+        this.ws = new WebSocket(this.get_ws_uri());
         this.ws.binaryType = 'arraybuffer';
         this.ws.onopen = function(evt) { onopen(evt) };
         this.ws.onclose = function(evt) { onclose(evt) };
         this.ws.onmessage = function(evt) { onmessage(evt) };
         this.ws.onerror = function(evt) { onerror(evt) };
 
+        this.init_wasm();
+
         this.t_start_ms = this.timestamp();
         this.t_requests_last_update_ms = this.timestamp() - this.k_requests_update_freq_ms;
 
@@ -86,11 +165,19 @@ var incppect = {
         }
 
         this.t_frame_begin_ms = this.timestamp();
-        this.requests_regenerate = this.t_frame_begin_ms - this.t_requests_last_update_ms > this.k_requests_update_freq_ms;
+
+        if (this.session_pending && this.t_frame_begin_ms - this.t_session_request_ms > this.k_session_timeout_ms) {
+            // no answer - the server does not support sessions
+            this.session_pending = false;
+            this.reset();
+        }
+
+        // nothing is sent until the server tells if the session was resumed
+        this.requests_regenerate = !this.session_pending &&
+            this.t_frame_begin_ms - this.t_requests_last_update_ms > this.k_requests_update_freq_ms;
 
         if (this.requests_regenerate) {
-            this.requests_old = this.requests;
-            this.requests = [];
+            this.requests = new Set();
         }
 
         try {
@@ -99,12 +186,28 @@ var incppect = {
             this.onerror('Failed to render state: ' + err);
         }
 
+        if (this.writes.size > 0 && !this.session_pending) {
+            this.send_writes();
+        }
+
         if (this.requests_regenerate) {
             if (this.requests_new_vars) {
                 this.send_var_to_id_map();
                 this.requests_new_vars = false;
             }
+            if (this.rates_changed) {
+                this.send_rates();
+            }
+            if (this.quantization_changed) {
+                this.send_quantization();
+            }
+            if (this.filters_changed) {
+                this.send_filters();
+            }
             this.send_requests();
+            if (this.frame_seq_acked != this.frame_header[0]) {
+                this.send_ack();
+            }
             this.t_requests_last_update_ms = this.timestamp();
         }
 
@@ -116,6 +219,17 @@ var incppect = {
             path = path.replace('%d', arguments[i]);
         }
 
+        this.add_var(path);
+
+        if (this.requests_regenerate) {
+            this.requests.add(this.var_to_id[path]);
+        }
+
+        return this.vars_map[path];
+    },
+
+    // assign an id to a var, registered with the server on the next update of the requests
+    add_var: function(path) {
         if (!(path in this.vars_map)) {
             this.vars_map[path] = new ArrayBuffer();
             this.var_to_id[path] = this.nvars;
@@ -123,13 +237,162 @@ var incppect = {
             ++this.nvars;
 
             this.requests_new_vars = true;
+            if (path in this.rates) {
+                this.rates_changed = true;
+            }
+            if (path in this.quantization) {
+                this.quantization_changed = true;
+            }
+            if (path in this.filters) {
+                this.filters_changed = true;
+            }
         }
+    },
 
-        if (this.requests_regenerate) {
-            this.requests.push(this.var_to_id[path]);
+    // write to a settable var. data - ArrayBuffer or typed array
+    // the writes are sent once per frame, only the last one is kept if a var is written several times in a frame
+    set: function(path, data, ...args) {
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
         }
 
-        return this.vars_map[path];
+        var bytes = ArrayBuffer.isView(data)
+            ? new Uint8Array(data.buffer, data.byteOffset, data.byteLength)
+            : new Uint8Array(data);
+        this.writes.set(path, bytes.slice());
+    },
+
+    set_int32: function(path, value, ...args) {
+        this.set(path, new Int32Array([value]), ...args);
+    },
+
+    set_uint32: function(path, value, ...args) {
+        this.set(path, new Uint32Array([value]), ...args);
+    },
+
+    set_float: function(path, value, ...args) {
+        this.set(path, new Float32Array([value]), ...args);
+    },
+
+    set_double: function(path, value, ...args) {
+        this.set(path, new Float64Array([value]), ...args);
+    },
+
+    // limit the update rate of a var to max_hz and ask for at least min_hz updates
+    // the server clamps max_hz to its own limit. 0 - server default / no minimum
+    rate: function(max_hz, min_hz, path, ...args) {
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
+        }
+
+        this.rates[path] = [
+            max_hz > 0 ? Math.round(1000.0/max_hz) : 0,
+            min_hz > 0 ? Math.round(1000.0/min_hz) : 0,
+        ];
+        this.rates_changed = true;
+    },
+
+    // typed array view of a var, cached per var buffer
+    // the buffers are patched in place by the decoder, so the views stay valid across frames
+    // until the size of the var changes
+    get_view: function(ctor, path, ...args) {
+        var abuf = this.get(path, ...args);
+        if ((ctor === Float32Array || ctor === Float64Array) && Object.keys(this.quantization_applied).length > 0) {
+            var dequantized = this.get_dequantized(ctor, abuf, path, ...args);
+            if (dequantized !== null) {
+                return dequantized;
+            }
+        }
+
+        var views = this.views.get(abuf);
+        if (views === undefined) {
+            views = {};
+            this.views.set(abuf, views);
+        }
+
+        var view = views[ctor.name];
+        if (view === undefined) {
+            view = new ctor(abuf, 0, Math.floor(abuf.byteLength/ctor.BYTES_PER_ELEMENT));
+            views[ctor.name] = view;
+        }
+        return view;
+    },
+
+    // send float32/float64 values of a var quantized, to cut their size and make the deltas smaller
+    // mode: 'int8', 'int16' - (value - offset)/scale rounded to an integer, 'fixed' - float32 rounded to scale
+    // null - full precision. get_float_arr()/get_double_arr() return the dequantized values
+    quantize: function(mode, scale, offset, path, ...args) {
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
+        }
+
+        var modes = { 'int8': 1, 'int16': 2, 'fixed': 3 };
+        this.quantization[path] = [modes[mode] || 0, scale || 1.0, offset || 0.0];
+        this.quantization_changed = true;
+    },
+
+    // receive only the elements of a var that pass a filter, e.g. filter('>', 0.5, 0, 'state.ball[*].energy')
+    // op: '>', '>=', '<', '<=', '==', '!=', 'abs>' - compared to a, 'between' - a <= value < b, null - no filter
+    // the elements are the vars of a wildcard path, or the elements of an array var
+    filter: function(op, a, b, path, ...args) {
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
+        }
+
+        var ops = { '>': 1, '>=': 2, '<': 3, '<=': 4, '==': 5, '!=': 6, 'abs>': 7, 'between': 8 };
+        this.filters[path] = [ops[op] || 0, a || 0.0, b || 0.0];
+        this.filters_changed = true;
+    },
+
+    // elements of a filtered var that pass the filter: Map of index -> value
+    // the index is the position in the array, or in batch_layouts[path] for wildcard paths
+    get_sparse: function(path, ...args) {
+        this.get(path, ...args);
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
+        }
+
+        if (!(path in this.sparse)) {
+            this.sparse[path] = new Map();
+        }
+        return this.sparse[path];
+    },
+
+    get_dequantized: function(ctor, abuf, path, ...args) {
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
+        }
+
+        var q = this.quantization_applied[path];
+        if (q === undefined) {
+            return null;
+        }
+
+        var cached = this.dequantized[path];
+        if (cached && cached.seq === this.frame_header[0] && cached.values.constructor === ctor) {
+            return cached.values;
+        }
+
+        // [element count][values] - the padding of the record is not part of the values
+        if (abuf.byteLength < 4) {
+            return new ctor(0);
+        }
+        var size = q[0] == 1 ? 1 : q[0] == 2 ? 2 : 4;
+        var n = Math.min(new Uint32Array(abuf, 0, 1)[0], Math.floor((abuf.byteLength - 4)/size));
+        var src = q[0] == 1 ? new Int8Array(abuf, 4, n) :
+                  q[0] == 2 ? new Int16Array(abuf, 4, n) :
+                              new Float32Array(abuf, 4, n);
+        var values = new ctor(src.length);
+        if (q[0] == 3) {
+            values.set(src);
+        } else {
+            for (var i = 0; i < src.length; ++i) {
+                values[i] = q[2] + src[i]*q[1];
+            }
+        }
+        this.dequantized[path] = { seq: this.frame_header[0], values: values };
+
+        return values;
     },
 
     get_abuf: function(path, ...args) {
@@ -141,8 +404,7 @@ var incppect = {
     },
 
     get_int8_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Int8Array(abuf);
+        return this.get_view(Int8Array, path, ...args);
     },
 
     get_uint8: function(path, ...args) {
@@ -150,8 +412,7 @@ var incppect = {
     },
 
     get_uint8_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Uint8Array(abuf);
+        return this.get_view(Uint8Array, path, ...args);
     },
 
     get_int16: function(path, ...args) {
@@ -159,8 +420,7 @@ var incppect = {
     },
 
     get_int16_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Int16Array(abuf);
+        return this.get_view(Int16Array, path, ...args);
     },
 
     get_uint16: function(path, ...args) {
@@ -168,8 +428,7 @@ var incppect = {
     },
 
     get_uint16_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Uint16Array(abuf);
+        return this.get_view(Uint16Array, path, ...args);
     },
 
     get_int32: function(path, ...args) {
@@ -177,8 +436,7 @@ var incppect = {
     },
 
     get_int32_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Int32Array(abuf);
+        return this.get_view(Int32Array, path, ...args);
     },
 
     get_uint32: function(path, ...args) {
@@ -186,8 +444,7 @@ var incppect = {
     },
 
     get_uint32_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Uint32Array(abuf);
+        return this.get_view(Uint32Array, path, ...args);
     },
 
     get_float: function(path, ...args) {
@@ -195,8 +452,7 @@ var incppect = {
     },
 
     get_float_arr: function(path, ...args) {
-        var abuf = this.get(path, ...args);
-        return new Float32Array(abuf);
+        return this.get_view(Float32Array, path, ...args);
     },
 
     get_double: function(path, ...args) {
@@ -204,8 +460,126 @@ var incppect = {
     },
 
     get_double_arr: function(path, ...args) {
+        return this.get_view(Float64Array, path, ...args);
+    },
+
+    // get the vars matched by a wildcard path, e.g. 'state.ball[*].x' or 'state.*'
+    // returns an object mapping the concrete paths to ArrayBuffers
+    get_batch: function(path, ...args) {
         var abuf = this.get(path, ...args);
-        return new Float64Array(abuf);
+        for (var i = 1; i < arguments.length; i++) {
+            path = path.replace('%d', arguments[i]);
+        }
+
+        var res = {};
+        var layout = this.batch_layouts[path] || [];
+        var offset = 0;
+        for (var i = 0; i < layout.length && offset + 4 <= abuf.byteLength; ++i) {
+            var size = (new Uint32Array(abuf, offset, 1))[0];
+            res[layout[i]] = abuf.slice(offset + 4, offset + 4 + size);
+            offset += 4 + 4*Math.ceil(size/4);
+        }
+        return res;
+    },
+
+    // get a var as a typed array, based on the type advertised by the server in the schema
+    // strings are returned as strings and vars without type info as Uint8Array
+    get_typed: function(path, ...args) {
+        var abuf = this.get(path, ...args);
+        var info = this.schema[path.replace(/\[-?\d*\]/g, '[%d]')];
+        if (!info) {
+            return this.get_view(Uint8Array, path, ...args);
+        }
+
+        if (info.type == 11) {
+            return this.get_str(path, ...args);
+        }
+
+        var ctors = [ Uint8Array, Int8Array, Uint8Array, Int16Array, Uint16Array, Int32Array, Uint32Array,
+                      BigInt64Array, BigUint64Array, Float32Array, Float64Array ];
+        var ctor = ctors[info.type] || Uint8Array;
+        if (ctor === Float32Array || ctor === Float64Array) {
+            var dequantized = this.get_dequantized(ctor, abuf, path, ...args);
+            if (dequantized !== null) {
+                return dequantized;
+            }
+        }
+        var n = Math.floor(abuf.byteLength/ctor.BYTES_PER_ELEMENT);
+        if (info.shape.length > 0) {
+            n = Math.min(n, info.shape.reduce(function(a, b) { return a*b; }, 1));
+        }
+        if (info.endianness == 0 || ctor.BYTES_PER_ELEMENT == 1) {
+            var view = this.get_view(ctor, path, ...args);
+            return view.length == n ? view : view.subarray(0, n);
+        }
+
+        // big endian data - convert to a native copy
+        var res = new ctor(n);
+        var dv = new DataView(abuf);
+        var getter = 'get' + ctor.name.replace('Array', '');
+        for (var i = 0; i < n; ++i) {
+            res[i] = dv[getter](i*ctor.BYTES_PER_ELEMENT, false);
+        }
+        return res;
+    },
+
+    send_schema_hash: function() {
+        var cached = null;
+        try {
+            cached = JSON.parse(window.localStorage.getItem('incppect.schema:' + this.get_ws_uri()));
+        } catch (err) {
+        }
+        if (cached && cached.hash) {
+            this.schema = cached.vars;
+            this.schema_hash = cached.hash;
+        }
+
+        var data = new Uint32Array(3);
+        data[0] = 6;
+        data[1] = this.schema_hash[0];
+        data[2] = this.schema_hash[1];
+        this.ws.send(data);
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.byteLength;
+    },
+
+    // [hash lo][hash hi][count][path length][type, endianness, ndims, flags][dims][path]...
+    on_schema: function(data) {
+        var int_view = new Uint32Array(data);
+        var bytes = new Uint8Array(data);
+        var dec = new TextDecoder('utf-8');
+
+        var vars = {};
+        var count = int_view[3];
+        var k = 4;
+        for (var i = 0; i < count; ++i) {
+            var path_len = int_view[k];
+            var type = bytes[4*(k + 1) + 0];
+            var endianness = bytes[4*(k + 1) + 1];
+            var ndims = bytes[4*(k + 1) + 2];
+            var settable = (bytes[4*(k + 1) + 3] & 1) != 0;
+            var shape = Array.from(new Int32Array(data, 4*(k + 2), ndims));
+            k += 2 + ndims;
+            var path = dec.decode(bytes.subarray(4*k, 4*k + path_len));
+            k += Math.ceil(path_len/4);
+
+            vars[path] = { type: type, endianness: endianness, shape: shape, settable: settable };
+        }
+
+        this.schema = vars;
+        this.schema_hash = [ int_view[1], int_view[2] ];
+        try {
+            window.localStorage.setItem('incppect.schema:' + this.get_ws_uri(),
+                                        JSON.stringify({ hash: this.schema_hash, vars: vars }));
+        } catch (err) {
+        }
+    },
+
+    // fetch the list of vars registered on the server
+    list_vars: function() {
+        var uri = this.get_ws_uri().replace(/^ws/, 'http') + '/vars';
+        return fetch(uri).then(function(res) { return res.json(); });
     },
 
     get_str: function(path, ...args) {
@@ -234,10 +608,52 @@ var incppect = {
         this.stats.tx_bytes += data.length;
     },
 
+    // call a remote procedure registered on the server with Incppect::rpc()
+    // payload can be a string, an ArrayBuffer or a typed array
+    // returns a promise that resolves with the response payload as an ArrayBuffer
+    call: function(method, payload) {
+        var self = this;
+        return new Promise(function(resolve, reject) {
+            if (self.ws == null || self.ws.readyState !== self.ws.OPEN) {
+                reject('not connected');
+                return;
+            }
+
+            var enc = new TextEncoder();
+            var name = enc.encode(method);
+            var body = new Uint8Array(0);
+            if (typeof payload === 'string') {
+                body = enc.encode(payload);
+            } else if (payload instanceof ArrayBuffer) {
+                body = new Uint8Array(payload);
+            } else if (ArrayBuffer.isView(payload)) {
+                body = new Uint8Array(payload.buffer, payload.byteOffset, payload.byteLength);
+            }
+
+            var name_len_padded = 4*Math.ceil(name.length/4);
+            var data = new Uint8Array(12 + name_len_padded + body.length);
+            var header = new Uint32Array(data.buffer, 0, 3);
+            var id = self.rpc_next_id++;
+            header[0] = 5;
+            header[1] = id;
+            header[2] = name.length;
+            data.set(name, 12);
+            data.set(body, 12 + name_len_padded);
+
+            self.rpc_pending[id] = { resolve: resolve, reject: reject };
+            self.ws.send(data);
+
+            self.stats.tx_n += 1;
+            self.stats.tx_bytes += data.length;
+        });
+    },
+
+    // register the vars that were added since the last call
     send_var_to_id_map: function() {
         var msg = '';
         var delim = this.k_var_delim;
-        for (var key in this.var_to_id) {
+        for (var id = this.nvars_registered; id < this.nvars; ++id) {
+            var key = this.id_to_var[id];
             var nidxs = 0;
             var idxs = delim;
             var keyp = key.replace(/\[-?\d*\]/g, function(m) { ++nidxs; idxs += m.replace(/[\[\]]/g, '') + delim; return '[%d]'; });
@@ -249,82 +665,313 @@ var incppect = {
         data.set(enc.encode(msg), 4);
         data[4 + msg.length] = 0;
         this.ws.send(data);
+        this.nvars_registered = this.nvars;
 
         this.stats.tx_n += 1;
         this.stats.tx_bytes += data.length;
     },
 
-    send_requests: function() {
-        var same = true;
-        if (this.requests_old === null || this.requests.length !== this.requests_old.length){
-            same = false;
-        } else {
-            for (var i = 0; i < this.requests.length; ++i) {
-                if (this.requests[i] !== this.requests_old[i]) {
-                    same = false;
-                    break;
-                }
+    // send the rates of the registered vars: [id][min interval ms][max interval ms]...
+    send_rates: function() {
+        var rates = [];
+        for (var path in this.rates) {
+            var id = this.var_to_id[path];
+            if (id !== undefined && id < this.nvars_registered) {
+                rates.push(id, this.rates[path][0], this.rates[path][1]);
             }
         }
+        this.rates_changed = false;
+
+        if (rates.length > 0) {
+            this.send_int32(9, rates);
+        }
+    },
 
-        if (same) {
-            var data = new Int32Array(1);
-            data[0] = 3;
-            this.ws.send(data);
+    // send the pending writes in a single message: [13][id][size][data, padded to 4 bytes]...
+    send_writes: function() {
+        var size = 4;
+        for (var [path, bytes] of this.writes) {
+            this.add_var(path);
+            size += 8 + 4*Math.ceil(bytes.length/4);
+        }
 
-            this.stats.tx_n += 1;
-            this.stats.tx_bytes += data.length;
-        } else {
-            var data = new Int32Array(this.requests.length + 1);
-            data.set(new Int32Array(this.requests), 1);
-            data[0] = 2;
-            this.ws.send(data);
+        if (this.requests_new_vars) {
+            this.send_var_to_id_map();
+            this.requests_new_vars = false;
+        }
 
-            this.stats.tx_n += 1;
-            this.stats.tx_bytes += data.length;
+        var data = new Uint8Array(size);
+        var words = new Int32Array(data.buffer);
+        var offset = 4;
+        words[0] = 13;
+        for (var [path, bytes] of this.writes) {
+            words[offset/4] = this.var_to_id[path];
+            words[offset/4 + 1] = bytes.length;
+            data.set(bytes, offset + 8);
+            offset += 8 + 4*Math.ceil(bytes.length/4);
         }
+        this.writes.clear();
+        this.ws.send(data);
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.length;
+    },
+
+    // send the quantization of the registered vars: [id][mode][scale][offset]...
+    send_quantization: function() {
+        var values = [];
+        for (var path in this.quantization) {
+            var id = this.var_to_id[path];
+            if (id !== undefined && id < this.nvars_registered) {
+                values.push(id, this.quantization[path]);
+            }
+        }
+        this.quantization_changed = false;
+
+        if (values.length == 0) {
+            return;
+        }
+
+        var data = new ArrayBuffer(4 + 8*values.length);
+        var ints = new Int32Array(data);
+        var floats = new Float32Array(data);
+        ints[0] = 14;
+        for (var i = 0; i < values.length; i += 2) {
+            ints[1 + 2*i] = values[i];
+            ints[2 + 2*i] = values[i + 1][0];
+            floats[3 + 2*i] = values[i + 1][1];
+            floats[4 + 2*i] = values[i + 1][2];
+        }
+        this.ws.send(data);
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.byteLength;
+    },
+
+    // send the filters of the registered vars: [id][op][a, float64][b, float64]...
+    send_filters: function() {
+        var entries = [];
+        for (var path in this.filters) {
+            var id = this.var_to_id[path];
+            if (id !== undefined && id < this.nvars_registered) {
+                entries.push([id, this.filters[path]]);
+            }
+        }
+        this.filters_changed = false;
+
+        if (entries.length == 0) {
+            return;
+        }
+
+        var data = new ArrayBuffer(4 + 24*entries.length);
+        var dv = new DataView(data);
+        dv.setInt32(0, 15, true);
+        for (var i = 0; i < entries.length; ++i) {
+            dv.setInt32(4 + 24*i, entries[i][0], true);
+            dv.setInt32(8 + 24*i, entries[i][1][0], true);
+            dv.setFloat64(12 + 24*i, entries[i][1][1], true);
+            dv.setFloat64(20 + 24*i, entries[i][1][2], true);
+        }
+        this.ws.send(data);
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.byteLength;
+    },
+
+    request_keyframe: function() {
+        this.keyframe_pending = true;
+        this.send_int32(11, []);
+    },
+
+    // a record could not be applied, so the var no longer matches the base of the next deltas
+    reject_record: function() {
+        this.stats.record_errors += 1;
+        if (!this.keyframe_pending) {
+            this.request_keyframe();
+        }
+    },
+
+    // acknowledge the last applied frame: [seq][frame timestamp][time since the frame was applied, us]
+    send_ack: function() {
+        var t_hold_us = Math.round(1000.0*(this.timestamp() - this.t_frame_applied_ms));
+        this.send_int32(10, [this.frame_header[0], this.frame_header[1], this.frame_header[2], t_hold_us]);
+        this.frame_seq_acked = this.frame_header[0];
+    },
+
+    // send the changes of the set of requested vars since the last call:
+    // type 7 - [ids to add], type 8 - [ids to remove], type 3 - keepalive if nothing changed
+    send_requests: function() {
+        var added = [];
+        var removed = [];
+        for (var id of this.requests) {
+            if (!this.requests_active.has(id)) added.push(id);
+        }
+        for (var id of this.requests_active) {
+            if (!this.requests.has(id)) removed.push(id);
+        }
+        this.requests_active = this.requests;
+
+        if (added.length == 0 && removed.length == 0) {
+            this.send_int32(3, []);
+        } else {
+            if (added.length > 0) this.send_int32(7, added);
+            if (removed.length > 0) this.send_int32(8, removed);
+        }
+    },
+
+    send_int32: function(type, values) {
+        var data = new Int32Array(values.length + 1);
+        data[0] = type;
+        data.set(values, 1);
+        this.ws.send(data);
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.byteLength;
     },
 
     onopen: function(evt) {
+        // resume the previous session, or ask for a new one: [token lo][token hi][seq of the last applied frame]
+        var token = this.session || [0, 0];
+        this.session_pending = this.session !== null;
+        this.t_session_request_ms = this.timestamp();
+        this.send_int32(12, [token[0], token[1], this.frame_header[0]]);
+
+        this.send_schema_hash();
     },
 
     onclose: function(evt) {
+        for (var id in this.rpc_pending) {
+            this.rpc_pending[id].reject('connection closed');
+        }
+        this.rpc_pending = {};
+
+        // the vars are kept until it is known whether the session can be resumed
+        this.session_pending = false;
+        if (this.session === null) {
+            this.reset();
+        }
+        this.ws = null;
+    },
+
+    // forget the registered vars and the delta state
+    reset: function() {
         this.nvars = 0;
         this.vars_map = {};
         this.var_to_id = {};
         this.id_to_var = {};
-        this.requests = null;
-        this.requests_old = null;
-        this.ws = null;
+        this.batch_layouts = {};
+        this.bundle_layout = [];
+        this.nvars_registered = 0;
+        this.requests = new Set();
+        this.requests_active = new Set();
+        this.rates_changed = true;
+        this.quantization_changed = true;
+        this.filters_changed = true;
+        this.sparse = {};
+        this.quantization_applied = {};
+        this.dequantized = {};
+        this.frame_header = [0, 0, 0];
+        this.frame_seq_acked = 0;
+        this.keyframe_pending = false;
+        this.last_data = null;
+        this.images = {};
     },
 
     onmessage: function(evt) {
         this.stats.rx_n += 1;
         this.stats.rx_bytes += evt.data.byteLength;
 
-        var type_all = (new Uint32Array(evt.data))[0];
-
-        if (this.last_data != null && type_all == 1) {
-            var ntotal = evt.data.byteLength/4 - 1;
+        var type_all = (new Uint32Array(evt.data, 0, 1))[0];
+
+        if (type_all == 2) {
+            // rpc response: [call id][status][payload]
+            var header = new Uint32Array(evt.data, 0, 3);
+            var pending = this.rpc_pending[header[1]];
+            if (pending) {
+                delete this.rpc_pending[header[1]];
+                if (header[2] == 0) {
+                    pending.resolve(evt.data.slice(12));
+                } else {
+                    pending.reject(header[2] == 1 ? 'unknown method' : new TextDecoder('utf-8').decode(evt.data.slice(12)));
+                }
+            }
+            return;
+        }
 
-            var src_view = new Uint32Array(evt.data, 4);
-            var dst_view = new Uint32Array(this.last_data, 4);
+        if (type_all == 3) {
+            this.on_schema(evt.data);
+            return;
+        }
 
-            var k = 0;
-            for (var i = 0; i < ntotal/2; ++i) {
-                var n = src_view[2*i + 0];
-                var c = src_view[2*i + 1];
-                for (var j = 0; j < n; ++j) {
-                    dst_view[k] = dst_view[k] ^ c;
-                    ++k;
+        if (type_all == 6) {
+            // quantization applied by the server: [id][mode][scale][offset]...
+            var ints = new Int32Array(evt.data);
+            var floats = new Float32Array(evt.data);
+            for (var i = 1; i + 3 < ints.length; i += 4) {
+                var path = this.id_to_var[ints[i]];
+                if (ints[i + 1] == 0) {
+                    delete this.quantization_applied[path];
+                } else {
+                    this.quantization_applied[path] = [ints[i + 1], floats[i + 2], floats[i + 3]];
                 }
+                delete this.dequantized[path];
+            }
+            return;
+        }
+
+        if (type_all == 5) {
+            // session: [token, 8 bytes][resumed]
+            var session = new Uint32Array(evt.data, 0, 4);
+            if (this.session_pending && session[3] == 0) {
+                // the session expired - the vars are registered again from scratch
+                this.reset();
+            }
+            this.session_pending = false;
+            this.session = (session[1] == 0 && session[2] == 0) ? null : [session[1], session[2]];
+            return;
+        }
+
+        // frames: [type all][seq][timestamp, 8 bytes][records]
+        //   type all 0 - frame, 1 - delta of the records of frame [base seq], 4 - keyframe
+        var header = new Uint32Array(evt.data, 0, 4);
+
+        if (type_all == 4) {
+            this.keyframe_pending = false;
+        } else if (!this.keyframe_pending) {
+            // frames other than keyframes can contain deltas against the previous frame
+            var base = type_all == 1 ? (new Uint32Array(evt.data, 16, 1))[0] : (header[1] - 1) >>> 0;
+            if (this.last_data == null || base != this.frame_header[0]) {
+                // the state can only be recovered from a keyframe
+                this.stats.seq_gaps += 1;
+                this.request_keyframe();
+            }
+        }
+
+        if (this.keyframe_pending) {
+            return;
+        }
+
+        this.frame_header = [header[1], header[2], header[3]];
+        this.t_frame_applied_ms = this.timestamp();
+
+        if (type_all == 1) {
+            var ntotal = evt.data.byteLength/4 - 5;
+
+            var src_view = new Uint32Array(evt.data, 20);
+            var dst_view = new Uint32Array(this.last_data, 16);
+
+            if (this.apply_xor_rle(src_view, ntotal/2, dst_view) != dst_view.length) {
+                this.stats.seq_gaps += 1;
+                this.request_keyframe();
+                return;
             }
+            new Uint32Array(this.last_data, 0, 4).set(header);
         } else {
             this.last_data = evt.data;
         }
 
         var int_view = new Uint32Array(this.last_data);
-        var offset = 1;
+        var offset = 4;
         var offset_new = 0;
         var total_size = this.last_data.byteLength;
         var id = 0;
@@ -336,33 +983,391 @@ var incppect = {
             len = int_view[offset + 2];
             offset += 3;
             offset_new = offset + len/4;
+            if (type != 4 && type != 5 && type != 6 && this.id_to_var[id] in this.images) {
+                this.mark_dirty(this.id_to_var[id], type == 7 ? this.last_data : null, 4*offset);
+            }
+
             if (type == 0) {
-                this.vars_map[this.id_to_var[id]] = this.last_data.slice(4*offset, 4*offset_new);
-            } else {
-                var src_view = new Uint32Array(this.last_data, 4*offset);
-                var dst_view = new Uint32Array(this.vars_map[this.id_to_var[id]]);
-
-                var k = 0;
-                for (var i = 0; i < len/8; ++i) {
-                    var n = src_view[2*i + 0];
-                    var c = src_view[2*i + 1];
-                    for (var j = 0; j < n; ++j) {
-                        dst_view[k] = dst_view[k] ^ c;
-                        ++k;
+                var path = this.id_to_var[id];
+                var dst = this.vars_map[path];
+                if (dst !== undefined && dst.byteLength == len) {
+                    // patch in place to keep the cached views valid
+                    new Uint8Array(dst).set(new Uint8Array(this.last_data, 4*offset, len));
+                } else {
+                    this.vars_map[path] = this.last_data.slice(4*offset, 4*offset_new);
+                }
+            } else if (type == 1) {
+                var dst = this.vars_map[this.id_to_var[id]];
+                if (dst === undefined ||
+                    this.apply_xor_rle(new Uint32Array(this.last_data, 4*offset), len/8, new Uint32Array(dst)) != dst.byteLength/4) {
+                    this.reject_record();
+                }
+            } else if (type == 2 || type == 3) {
+                // chunk of a large var: [total size][byte offset][payload]
+                var path = this.id_to_var[id];
+                var total = int_view[offset + 0];
+                var dst_offset = int_view[offset + 1];
+                if (path === undefined || len < 8 || dst_offset % 4 != 0 || dst_offset > total ||
+                    (type == 2 && len - 8 > total - dst_offset)) {
+                    this.reject_record();
+                    offset = offset_new;
+                    continue;
+                }
+                if (this.vars_map[path] === undefined || this.vars_map[path].byteLength != total) {
+                    this.vars_map[path] = new ArrayBuffer(total);
+                }
+
+                if (type == 2) {
+                    var src_bytes = new Uint8Array(this.last_data, 4*(offset + 2), len - 8);
+                    new Uint8Array(this.vars_map[path], dst_offset, len - 8).set(src_bytes);
+                } else {
+                    var src_view = new Uint32Array(this.last_data, 4*(offset + 2));
+                    var dst_view = new Uint32Array(this.vars_map[path], dst_offset, Math.floor((total - dst_offset)/4));
+
+                    if (this.apply_xor_rle(src_view, (len - 8)/8, dst_view) > dst_view.length) {
+                        this.reject_record();
+                    }
+                }
+            } else if (type == 4) {
+                // layout of a batch: [count][path length][path]...
+                var count = int_view[offset];
+                var bytes = new Uint8Array(this.last_data);
+                var dec = new TextDecoder('utf-8');
+                var layout = [];
+                var k = offset + 1;
+                for (var i = 0; i < count; ++i) {
+                    var path_len = int_view[k];
+                    layout.push(dec.decode(bytes.subarray(4*(k + 1), 4*(k + 1) + path_len)));
+                    k += 1 + Math.ceil(path_len/4);
+                }
+                this.batch_layouts[this.id_to_var[id]] = layout;
+            } else if (type == 5) {
+                // layout of the bundle of small vars: [count][id, size]...
+                var count = int_view[offset];
+                this.bundle_layout = Array.from(int_view.subarray(offset + 1, offset + 1 + 2*count));
+            } else if (type == 6) {
+                // bundle: the data of the vars in the layout, each padded to 4 bytes
+                var k = 4*offset;
+                for (var i = 0; i + 1 < this.bundle_layout.length; i += 2) {
+                    var path = this.id_to_var[this.bundle_layout[i]];
+                    var size = this.bundle_layout[i + 1];
+                    if (path === undefined || k + size > 4*offset_new) {
+                        this.reject_record();
+                        break;
+                    }
+                    var dst = this.vars_map[path];
+                    if (dst !== undefined && dst.byteLength == size) {
+                        new Uint8Array(dst).set(new Uint8Array(this.last_data, k, size));
+                    } else {
+                        this.vars_map[path] = this.last_data.slice(k, k + size);
                     }
+                    k += size;
+                }
+            } else if (type == 7) {
+                var dst = this.vars_map[this.id_to_var[id]];
+                if (dst === undefined || !this.apply_tiles(int_view, offset, len, new Uint8Array(dst))) {
+                    this.reject_record();
+                }
+            } else if (type == 8) {
+                // elements that pass the filter: [flags][nremoved][nset][removed indices][set indices][set values, float64]
+                var path = this.id_to_var[id];
+                var nremoved = int_view[offset + 1];
+                var nset = int_view[offset + 2];
+                if (path === undefined || len < 12 || 12 + 4*nremoved + 12*nset > len) {
+                    this.reject_record();
+                    offset = offset_new;
+                    continue;
+                }
+                var elements = this.sparse[path] || new Map();
+                if (int_view[offset] & 1) {
+                    elements.clear();
                 }
+                for (var i = 0; i < nremoved; ++i) {
+                    elements.delete(int_view[offset + 3 + i]);
+                }
+                var dv = new DataView(this.last_data, 4*(offset + 3 + nremoved + nset), 8*nset);
+                for (var i = 0; i < nset; ++i) {
+                    elements.set(int_view[offset + 3 + nremoved + i], dv.getFloat64(8*i, true));
+                }
+                this.sparse[path] = elements;
             }
             offset = offset_new;
         }
     },
 
+    // tiles of an image that changed:
+    // [width][height][format][pixel size][tile size][count][tile index][encoding][size][data]...
+    // encoding 0 - the pixels of the tile, row by row, 1 - xor-rle against the previous pixels
+    // returns false if the tiles do not match the image
+    apply_tiles: function(int_view, offset, size, dst) {
+        if (size < 24) {
+            return false;
+        }
+        var width = int_view[offset + 0];
+        var height = int_view[offset + 1];
+        var pixel_size = int_view[offset + 3];
+        var tile_size = int_view[offset + 4];
+        var count = int_view[offset + 5];
+        if (width == 0 || height == 0 || pixel_size == 0 || tile_size == 0 ||
+            tile_size > width || tile_size > height || width*height*pixel_size > dst.length) {
+            return false;
+        }
+        var ntx = Math.ceil(width/tile_size);
+        var nty = Math.ceil(height/tile_size);
+        var stride = width*pixel_size;
+
+        var src = new Uint8Array(int_view.buffer);
+        var k = offset + 6;
+        var end = offset + size/4;
+        for (var i = 0; i < count; ++i) {
+            if (k + 3 > end) {
+                return false;
+            }
+            var index = int_view[k + 0];
+            var encoding = int_view[k + 1];
+            var len = int_view[k + 2];
+            k += 3;
+            if (index >= ntx*nty || len > 4*(end - k)) {
+                return false;
+            }
+
+            var x0 = (index % ntx)*tile_size;
+            var y0 = Math.floor(index/ntx)*tile_size;
+            var y1 = Math.min(y0 + tile_size, height);
+            var row_bytes = Math.min(tile_size, width - x0)*pixel_size;
+            if ((y1 - 1)*stride + x0*pixel_size + row_bytes > dst.length) {
+                return false;
+            }
+            var tile = new Uint8Array(4*Math.ceil(row_bytes*(y1 - y0)/4));
+            if (encoding == 1) {
+                for (var y = y0; y < y1; ++y) {
+                    tile.set(dst.subarray(y*stride + x0*pixel_size, y*stride + x0*pixel_size + row_bytes), (y - y0)*row_bytes);
+                }
+                this.apply_xor_rle(int_view.subarray(k), len/8, new Uint32Array(tile.buffer));
+            } else {
+                tile.set(src.subarray(4*k, 4*k + Math.min(len, tile.length)));
+            }
+            for (var y = y0; y < y1; ++y) {
+                dst.set(tile.subarray((y - y0)*row_bytes, (y - y0 + 1)*row_bytes), y*stride + x0*pixel_size);
+            }
+            k += Math.ceil(len/4);
+        }
+        return true;
+    },
+
+    // extend the dirty region of an image var by the tiles in a record, or by the whole image
+    mark_dirty: function(path, data, byte_offset) {
+        var image = this.images[path];
+        if (data === null || image.dirty === true) {
+            image.dirty = true;
+            return;
+        }
+
+        var int_view = new Uint32Array(data, byte_offset);
+        if (int_view[5] == 0) {
+            return;
+        }
+
+        var width = int_view[0];
+        var height = int_view[1];
+        var tile_size = int_view[4];
+        if (tile_size == 0 || tile_size > width || tile_size > height) {
+            image.dirty = true;
+            return;
+        }
+        var ntx = Math.ceil(width/tile_size);
+        var rect = image.dirty || [width, height, 0, 0];
+        var k = 6;
+        for (var i = 0; i < int_view[5]; ++i) {
+            var x0 = (int_view[k] % ntx)*tile_size;
+            var y0 = Math.floor(int_view[k]/ntx)*tile_size;
+            rect = [Math.min(rect[0], x0), Math.min(rect[1], y0),
+                    Math.max(rect[2], Math.min(x0 + tile_size, width)), Math.max(rect[3], Math.min(y0 + tile_size, height))];
+            k += 3 + Math.ceil(int_view[k + 2]/4);
+        }
+        image.dirty = rect;
+    },
+
+    // RGBA pixels of an image var registered with Incppect::image(), converted from its pixel format
+    // returns null until the var and its schema have arrived. only the pixels that changed are converted
+    // the returned object has { width, height, rgba: Uint8ClampedArray, dirty: [x0, y0, x1, y1] | true | null },
+    // call the blit helpers below, or reset dirty to null after drawing the image yourself
+    get_image: function(path, ...args) {
+        var abuf = this.get(path, ...args);
+        for (var i = 0; i < args.length; i++) {
+            path = path.replace('%d', args[i]);
+        }
+
+        var info = this.schema[path.replace(/\[-?\d*\]/g, '[%d]')];
+        if (!info || info.shape.length != 3) {
+            return null;
+        }
+
+        var height = info.shape[0];
+        var width = info.shape[1];
+        var channels = info.shape[2];
+        var ctor = info.type == 4 ? Uint16Array : info.type == 9 ? Float32Array : Uint8Array;
+        if (abuf.byteLength < width*height*channels*ctor.BYTES_PER_ELEMENT) {
+            return null;
+        }
+
+        var image = this.images[path];
+        if (!image || image.width != width || image.height != height) {
+            image = { width: width, height: height, rgba: new Uint8ClampedArray(4*width*height), dirty: true, converted: null };
+            this.images[path] = image;
+        }
+        if (image.dirty === null || image.converted === image.dirty) {
+            return image;
+        }
+
+        var rect = image.dirty === true ? [0, 0, width, height] : image.dirty;
+        var src = new ctor(abuf, 0, width*height*channels);
+        var dst = image.rgba;
+        for (var y = rect[1]; y < rect[3]; ++y) {
+            for (var x = rect[0]; x < rect[2]; ++x) {
+                var s = (y*width + x)*channels;
+                var d = 4*(y*width + x);
+                if (channels >= 3) {
+                    dst[d + 0] = src[s + 0];
+                    dst[d + 1] = src[s + 1];
+                    dst[d + 2] = src[s + 2];
+                    dst[d + 3] = channels == 4 ? src[s + 3] : 255;
+                } else {
+                    // Gray16 keeps the high byte, Float32 is expected in [0, 1]
+                    var v = ctor === Uint16Array ? src[s] >> 8 : ctor === Float32Array ? 255*src[s] : src[s];
+                    dst[d + 0] = v;
+                    dst[d + 1] = v;
+                    dst[d + 2] = v;
+                    dst[d + 3] = 255;
+                }
+            }
+        }
+        image.converted = image.dirty;
+
+        return image;
+    },
+
+    // draw an image var on a 2D canvas context at (x, y), updating only the region that changed
+    blit_image: function(ctx, x, y, path, ...args) {
+        var image = this.get_image(path, ...args);
+        if (image === null) {
+            return false;
+        }
+
+        if (!image.image_data) {
+            image.image_data = new ImageData(image.rgba, image.width, image.height);
+            image.dirty = true;
+        }
+        if (image.dirty !== null) {
+            var rect = image.dirty === true ? [0, 0, image.width, image.height] : image.dirty;
+            ctx.putImageData(image.image_data, x, y, rect[0], rect[1], rect[2] - rect[0], rect[3] - rect[1]);
+            image.dirty = null;
+            image.converted = null;
+        }
+        return true;
+    },
+
+    // upload an image var to a WebGL RGBA texture if it changed since the last upload
+    upload_image: function(gl, texture, path, ...args) {
+        var image = this.get_image(path, ...args);
+        if (image === null) {
+            return false;
+        }
+
+        if (image.dirty !== null) {
+            var pixels = new Uint8Array(image.rgba.buffer);
+            gl.bindTexture(gl.TEXTURE_2D, texture);
+            gl.texImage2D(gl.TEXTURE_2D, 0, gl.RGBA, image.width, image.height, 0, gl.RGBA, gl.UNSIGNED_BYTE, pixels);
+            image.dirty = null;
+            image.converted = null;
+        }
+        return true;
+    },
+
+    // xor the (count, value) runs in src_view into dst_view
+    // returns the number of words covered by the runs - runs past the end of dst_view are clipped
+    apply_xor_rle: function(src_view, npairs, dst_view) {
+        if (this.wasm !== null && npairs > 1 && dst_view.length >= this.k_wasm_min_words) {
+            // words covered by the runs and words that actually change - the wasm path copies all covered words in
+            // and out, so it only pays off when most of them change
+            var nwords = 0;
+            var ndirty = 0;
+            for (var i = 0; i < npairs; ++i) {
+                nwords += src_view[2*i + 0];
+                if (src_view[2*i + 1] != 0) {
+                    ndirty += src_view[2*i + 0];
+                }
+            }
+            if (nwords <= dst_view.length && ndirty >= this.k_wasm_min_words && 2*ndirty >= nwords &&
+                this.apply_xor_rle_wasm(src_view, npairs, dst_view.subarray(0, nwords))) {
+                return nwords;
+            }
+        }
+
+        var k = 0;
+        for (var i = 0; i < npairs; ++i) {
+            var n = src_view[2*i + 0];
+            var c = src_view[2*i + 1];
+            if (c != 0) {
+                // runs of zeros are unchanged words
+                for (var j = k, end = Math.min(k + n, dst_view.length); j < end; ++j) {
+                    dst_view[j] ^= c;
+                }
+            }
+            k += n;
+        }
+        return k;
+    },
+
+    // xor_rle(src, npairs, dst) compiled to WebAssembly with 128-bit SIMD
+    k_wasm_xor_rle: 'AGFzbQEAAAABBwFgA39/fwADAgEABQMBAAEHFAIGbWVtb3J5AgAHeG9yX3JsZQAACpwBAZkBAgR/AXsgACABQQN0aiEDAkADQCAAIANPDQEgACgCACEEIAAoAgQhBSAAQQhqIQAgAiAEQQJ0aiEGIAUEQCAF/REhBwJAA0AgAkEQaiAGSw0BIAIgAv0AAAAgB/1R/QsAACACQRBqIQIMAAsLAkADQCACIAZPDQEgAiACKAIAIAVzNgIAIAJBBGohAgwACwsLIAYhAgwACwsL',
+
+    init_wasm: function() {
+        if (this.wasm !== null || typeof WebAssembly !== 'object') {
+            return;
+        }
+
+        try {
+            var bytes = Uint8Array.from(atob(this.k_wasm_xor_rle), function(c) { return c.charCodeAt(0); });
+            if (WebAssembly.validate(bytes)) {
+                this.wasm = new WebAssembly.Instance(new WebAssembly.Module(bytes));
+            }
+        } catch (err) {
+            this.wasm = null;
+        }
+    },
+
+    apply_xor_rle_wasm: function(src_view, npairs, dst_view) {
+        var src_bytes = 8*npairs;
+        var dst_bytes = dst_view.byteLength;
+        var memory = this.wasm.exports.memory;
+        var need = src_bytes + dst_bytes + 16;
+        if (memory.buffer.byteLength < need) {
+            memory.grow(Math.ceil((need - memory.buffer.byteLength)/65536));
+        }
+
+        var heap = new Uint8Array(memory.buffer);
+        heap.set(new Uint8Array(src_view.buffer, src_view.byteOffset, src_bytes), 0);
+        heap.set(new Uint8Array(dst_view.buffer, dst_view.byteOffset, dst_bytes), src_bytes);
+        try {
+            this.wasm.exports.xor_rle(0, npairs, src_bytes);
+        } catch (err) {
+            return false;
+        }
+        new Uint8Array(dst_view.buffer, dst_view.byteOffset, dst_bytes).set(new Uint8Array(memory.buffer, src_bytes, dst_bytes));
+
+        return true;
+    },
+
     onerror: function(evt) {
         console.error("[incppect]", evt);
     },
 
     render: function() {
     },
-}
+}, config); };
+
+var incppect = incppect_create();
 
 
 )js";
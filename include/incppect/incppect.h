@@ -7,20 +7,34 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <fstream>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
 #include "App.h" // uWebSockets
+#include "codec.h"
 #include "common.h"
+#include "local_server.h"
+#include "path_trie.h"
+#include "shm.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
 
 template <bool SSL>
 struct Incppect
@@ -31,9 +45,129 @@ struct Incppect
       Custom,
    };
 
+   // requests with High priority are sent every update regardless of the bandwidth budget of the client
+   // Normal and Low priority requests share the remaining budget in round-robin order, Normal ones first
+   enum struct Priority : uint8_t {
+      Low,
+      Normal,
+      High,
+   };
+
+   // element type of the data returned by a getter, advertised to the clients in the schema
+   enum struct ElementType : uint8_t {
+      Raw,
+      Int8,
+      UInt8,
+      Int16,
+      UInt16,
+      Int32,
+      UInt32,
+      Int64,
+      UInt64,
+      Float32,
+      Float64,
+      String,
+   };
+
+   enum struct Endianness : uint8_t {
+      Little,
+      Big,
+   };
+
+   // pixel layout of an image var
+   enum struct PixelFormat : uint8_t {
+      Gray8,
+      RGB8,
+      RGBA8,
+      Gray16,
+      Float32,
+   };
+
+   // 2D buffer, e.g. a rendered frame or a heatmap, stored row by row without padding
+   // the deltas are sent as the tiles of tileSize x tileSize pixels that changed since the last update
+   // tileSize is clipped to the smaller side of the image
+   struct ImageOptions
+   {
+      int32_t width = 0;
+      int32_t height = 0;
+      PixelFormat format = PixelFormat::RGBA8;
+      int32_t tileSize = 32;
+   };
+
+   static constexpr Endianness kNativeEndianness =
+      std::endian::native == std::endian::little ? Endianness::Little : Endianness::Big;
+
    using TGetter = std::function<std::string_view(const std::vector<int>& idxs)>;
+   using TSetter = std::function<void(const std::vector<int>& idxs, std::string_view data)>;
+   using TExtent = IncppectPathTrie::TExtent;
    using THandler = std::function<void(int clientId, EventType etype, std::string_view)>;
+   using TRpcHandler = std::function<std::string(int32_t clientId, std::string_view payload)>;
+
+   // status of an rpc response
+   enum struct RpcStatus : uint32_t {
+      Ok,
+      UnknownMethod,
+      Error,
+   };
    
+   // per-var options, specified at registration time
+   struct VarOptions
+   {
+      Priority priority = Priority::Normal;
+
+      // evaluate the getter on the worker threads - the frames contain the latest completed result
+      // the getter must be safe to call from any thread
+      bool async = false;
+
+      // sync getters that take longer than this are made async automatically - only for getters that are safe to call
+      // from any thread. -1 - use Parameters::tGetterBudget_us, 0 - never
+      int64_t tBudget_us = -1;
+
+      // type metadata, sent to the clients in the schema
+      ElementType type = ElementType::Raw;
+      std::vector<int32_t> shape{};
+      Endianness endianness = kNativeEndianness;
+
+      // set by image() - width 0 for the other vars
+      ImageOptions image{};
+   };
+
+   // aggregate of the vars matched by a pattern, see derive()
+   enum struct Reduction : uint8_t {
+      Sum,
+      Min,
+      Max,
+      Mean,
+      Count,
+      Histogram, // [bins] x uint32 counts of the values in [lo, hi), the values outside are clamped to the edges
+      TopK,      // [k] x (value, element index) as float64, largest values first
+   };
+
+   struct DeriveOptions
+   {
+      Reduction reduction = Reduction::Sum;
+
+      int32_t bins = 16;
+      double lo = 0.0;
+      double hi = 1.0;
+
+      int32_t k = 8;
+
+      // re-read only the inputs passed to invalidate() since the last tick instead of all of them
+      // Sum, Mean, Count and Histogram are then updated from the changed elements, Min, Max and TopK still scan all of
+      // the values. all inputs are read again when the matched vars change, when a re-read input changes its number
+      // of elements and every kDerivedRecomputeTicks updates
+      bool incremental = false;
+   };
+
+   // per-rpc options, specified at registration time
+   struct RpcOptions
+   {
+      // run the handler on the worker threads instead of the service loop
+      // with Parameters::tRpcSlow_us set, sync handlers that take longer are moved to the workers automatically
+      bool async = false;
+   };
+
    bool print_debug = false;
 
    // service parameters
@@ -41,9 +175,78 @@ struct Incppect
    {
       int32_t portListen = 3000;
       int32_t maxPayloadLength_bytes = 256 * 1024;
+      int32_t maxChunkSize_bytes = 64 * 1024; // larger vars are streamed in chunks over several updates
+
+      // vars of at most this size are packed into a single record per client, 0 - disabled
+      int32_t maxBundledSize_bytes = 8;
       int64_t tLastRequestTimeout_ms = 3000;
       int32_t tIdleTimeout_s = 120;
 
+      // interval between keyframes - full frames that resynchronize the delta state of the clients, 0 - only on request
+      int64_t tKeyframeInterval_ms = 30000;
+
+      // default interval between updates of a request
+      // clients can ask for longer intervals per request, but never for shorter ones
+      int64_t tMinUpdate_ms = 16;
+
+      // outgoing bandwidth budget per client, 0 - unlimited
+      // can be overridden for individual clients via setClientBudget()
+      int64_t txBudget_bytes_per_s = 0;
+
+      // the requests and the delta state of a disconnected client are kept for this long, 0 - disabled
+      // a client that reconnects in time resumes its session without registering its requests again
+      int64_t tSessionGrace_ms = 10000;
+
+      // send the frames as soon as the clients ask for them. when disabled, the frames only go out when the application
+      // calls update() - e.g. from a timer on the loop of an attached app
+      bool updateOnRequest = true;
+
+      // run the setters of the vars on the service loop as the writes arrive
+      // by default the writes are queued and applied by the application via applyWrites()
+      bool applyWritesOnLoop = false;
+
+      // memory limits, 0 - unlimited
+      // requests registered past maxRequestsPerClient are ignored. when the delta state (the last sent data, the sent
+      // filtered sets and the encoding buffers of the requests) exceeds the limits, the least recently updated requests
+      // lose it until the state is 3/4 of the limit. they are sent in full without keeping a delta base for
+      // tDeltaCooldown_ms. the frame buffers, the snapshots of the vars being streamed and the values of the bundled
+      // vars are not counted - they are bounded by maxPayloadLength_bytes and maxBundledSize_bytes
+      int32_t maxRequestsPerClient = 16 * 1024;
+      int64_t maxDeltaStatePerClient_bytes = 64 * 1024 * 1024;
+      int64_t maxDeltaStateTotal_bytes = 1024 * 1024 * 1024;
+      int64_t tDeltaCooldown_ms = 5000;
+
+      // worker threads for async getters and slow rpc handlers
+      int32_t nWorkers = 2;
+
+      // sync rpc handlers that take longer than this are moved to the workers, 0 - never
+      // only for applications whose handlers are safe to call from any thread
+      int64_t tRpcSlow_us = 0;
+
+      // default VarOptions::tBudget_us, 0 - getters are never moved to the workers unless their vars ask for it
+      int64_t tGetterBudget_us = 0;
+
+      // unix domain socket for local clients, empty - disabled
+      // the protocol is the same as over the websocket, with every message prefixed by its size
+      // local clients are disconnected when their unsent data exceeds maxLocalBuffered_bytes
+      std::string unixSocketPath{};
+      int64_t maxLocalBuffered_bytes = 1024 * 1024;
+
+      // shared memory snapshot of the vars in shmVars, empty - disabled, e.g. "/incppect"
+      // shmVars can contain concrete paths ("state.ball[3].x") and wildcard patterns ("state.ball[*].x")
+      std::string shmName{};
+      std::vector<std::string> shmVars{};
+      int64_t shmCapacity_bytes = 1024 * 1024;
+      int64_t tShmUpdate_ms = 16;
+
+      // permissions of the unix socket file and the shared memory object
+      uint32_t localAccessMode = 0600;
+
+      // prefix of the routes of the instance - the websocket is served at "<route>", the js client at "<route>.js" and
+      // the list of vars at "<route>/vars". instances that run their own server need different ports, instances attached
+      // to the same app need different routes. pages connect to other routes with incppect.create({ route: ... })
+      std::string route = "/incppect";
+
       std::string httpRoot = ".";
       std::vector<std::string> resources{};
 
@@ -58,15 +261,69 @@ struct Incppect
 
    Incppect()
    {
-      var("incppect.nclients", [this](const std::vector<int>&) { return view(socketData.size()); });
-      var("incppect.tx_total", [this](const std::vector<int>&) { return view(txTotal_bytes); });
-      var("incppect.rx_total", [this](const std::vector<int>&) { return view(rxTotal_bytes); });
-      var("incppect.ip_address[%d]", [this](const std::vector<int>& idxs) {
-         auto it = clientData.cbegin();
-         std::advance(it, idxs[0]);
-         return view(it->second.ipAddress);
-      });
+      // the built-in vars access the service state, so they always run on the service loop
+      const VarOptions kInternal = {.tBudget_us = 0};
+
+      var("incppect.nclients", [this](const std::vector<int>&) { return view(clientData.size()); }, kInternal);
+      var("incppect.tx_total", [this](const std::vector<int>&) { return view(txTotal_bytes); }, kInternal);
+      var("incppect.rx_total", [this](const std::vector<int>&) { return view(rxTotal_bytes); }, kInternal);
+      var(
+         "incppect.ip_address[%d]",
+         [this](const std::vector<int>& idxs) {
+            auto it = clientData.cbegin();
+            std::advance(it, idxs[0]);
+            return view(it->second.ipAddress);
+         },
+         kInternal);
+
+      // latency of the clients, measured from the frame acknowledgements
+      var(
+         "incppect.rtt_us[%d]",
+         [this](const std::vector<int>& idxs) {
+            const auto it = clientData.find(idxs[0]);
+            return it == clientData.end() ? std::string_view{} : view(it->second.rtt_us);
+         },
+         kInternal);
+      var(
+         "incppect.rtt_hist[%d]",
+         [this](const std::vector<int>& idxs) {
+            const auto it = clientData.find(idxs[0]);
+            return it == clientData.end() ? std::string_view{} : view(it->second.rttHist);
+         },
+         kInternal);
+      var(
+         "incppect.frames_in_flight[%d]",
+         [this](const std::vector<int>& idxs) {
+            const auto it = clientData.find(idxs[0]);
+            return it == clientData.end() ? std::string_view{} : view(it->second.nFramesInFlight);
+         },
+         kInternal);
+
+      // memory used for the delta encoding, see Parameters::maxDeltaStateTotal_bytes
+      var("incppect.delta_state_total", [this](const std::vector<int>&) { return view(deltaStateTotal_bytes); },
+          kInternal);
+      var(
+         "incppect.delta_state[%d]",
+         [this](const std::vector<int>& idxs) {
+            const auto it = clientData.find(idxs[0]);
+            return it == clientData.end() ? std::string_view{} : view(it->second.deltaState_bytes);
+         },
+         kInternal);
+      var("incppect.delta_evictions", [this](const std::vector<int>&) { return view(nDeltaEvictions); }, kInternal);
+      var("incppect.requests_rejected", [this](const std::vector<int>&) { return view(nRequestsRejected); },
+          kInternal);
+      var("incppect.writes_dropped", [this](const std::vector<int>&) { return view(nWritesDropped); }, kInternal);
+   }
+
+   ~Incppect()
+   {
+      if (serviceThread.joinable()) {
+         shutdown(0);
+      }
    }
+
+   Incppect(const Incppect&) = delete;
+   Incppect& operator=(const Incppect&) = delete;
    
    static int64_t timestamp()
    {
@@ -75,26 +332,90 @@ struct Incppect
          .count();
    }
 
+   // monotonic time in microseconds, used for the frame timestamps
+   static int64_t timestamp_us()
+   {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+         .count();
+   }
+
    // run the incppect service main loop in the current thread
    // blocking call
    void run(Parameters parameters)
    {
-      this->parameters = parameters;
+      {
+         std::lock_guard lock(loopMutex);
+         this->parameters = std::move(parameters);
+         isServing = true;
+      }
       run();
    }
 
+   // serve the instance from an existing app instead of running a server of its own
+   // registers the websocket and the http routes on the app and starts the local transports. call it from the thread
+   // that runs the app, before the app runs. the app listens and runs its loop as before - see
+   // Parameters::updateOnRequest for driving the updates from a timer of the application
+   void attach(uWS::TemplatedApp<SSL>& app, Parameters parameters)
+   {
+      this->parameters = parameters;
+      attach(app);
+   }
+
    // terminate the server instance   
    void stop()
    {
+      deferToLoop([this]() { closeAll(); });
+   }
+
+   // run the service in a thread owned by the instance - see shutdown()
+   // returns once the service is up, false if the instance already runs a service thread or failed to listen
+   bool start(Parameters parameters)
+   {
+      if (serviceThread.joinable()) {
+         return false;
+      }
+
+      std::unique_lock lock(loopMutex);
+      this->parameters = std::move(parameters);
+      isServing = true;
+      isStarting = true;
+      serviceThread = std::thread([this]() { this->run(); });
+      startedCv.wait(lock, [this]() { return isStarting == false; });
+
+      return isRunning();
+   }
+
+   // terminate the server instance without losing data: stop accepting new clients, send the pending frames and close
+   // the connections once they are flushed, or after tDrain_ms at the latest. the sessions of the clients are kept, so
+   // the viewers of an instance restarted with start() resume where they left off. joins the thread started by start()
+   void shutdown(int64_t tDrain_ms = 1000)
+   {
+      deferToLoop([this, tDrain_ms]() { drain(tDrain_ms); });
+
+      if (serviceThread.joinable() && serviceThread.get_id() != std::this_thread::get_id()) {
+         serviceThread.join();
+      }
+   }
+
+   bool isRunning() const { return running; }
+
+   // change the parameters of a running instance
+   // the parameters are applied between two updates. the ones that the server is set up with - the port, the route,
+   // the transports, the payload and idle limits, the number of workers and the served files - keep their values
+   void reconfigure(Parameters parameters)
+   {
+      std::lock_guard lock(loopMutex);
       if (mainLoop != nullptr) {
-         mainLoop->defer([this]() {
-            for (auto [id, socket_data] : socketData) {
-               if (socket_data->mainLoop) {
-                  socket_data->mainLoop->defer([socket_data]() { socket_data->ws->close(); });
-               }
-            }
-            us_listen_socket_close(0, listenSocket);
-         });
+         mainLoop->defer(
+            [this, parameters = std::move(parameters)]() mutable { applyParameters(std::move(parameters)); });
+      }
+      else if (isServing) {
+         // the service is starting or stopping and reads the parameters without the lock
+         pendingParameters = std::move(parameters);
+      }
+      else {
+         this->parameters = std::move(parameters);
       }
    }
 
@@ -104,14 +425,25 @@ struct Incppect
       resources[url] = content;
    }
 
-   // number of connected clients   
+   // number of connected clients of all transports, as the incppect.nclients var
+   // must be called from the thread running the service
    int32_t nConnected() const
    {
-      return socketData.size();
+      return clientData.size();
+   }
+
+   // set the outgoing bandwidth budget of a client in bytes/s, 0 - unlimited, -1 - use Parameters
+   // must be called from the thread running the service (e.g. from the handler)
+   void setClientBudget(int32_t clientId, int64_t txBudget_bytes_per_s)
+   {
+      if (auto it = clientData.find(clientId); it != clientData.end()) {
+         it->second.txBudget_bytes_per_s = txBudget_bytes_per_s;
+      }
    }
 
    // run the incppect service main loop in dedicated thread
    // non-blocking call, returns the created std::thread   
+   // prefer start() and shutdown() for an instance whose service is restarted or stopped before the process exits
    std::thread runAsync(Parameters parameters)
    {
       std::thread worker([this, parameters]() { this->run(parameters); });
@@ -125,15 +457,281 @@ struct Incppect
    //   var("path0", [](auto ) { ... });
    //   var("path1[%d]", [](auto idxs) { ... idxs[0] ... });
    //   var("path2[%d].foo[%d]", [](auto idxs) { ... idxs[0], idxs[1] ... });
+   //   var("path3", [](auto ) { ... }, { .priority = Priority::High });
+   //   var("path4", [](auto ) { ... }, { .type = ElementType::Float32, .shape = { 4, 4 } });
+   //   var("path5", [](auto ) { ... }, typed<double>());
+   //
+   bool var(const std::string& path, TGetter&& getter, VarOptions options = {})
+   {
+      pathTrie.insert(path, int32_t(getters.size()));
+      getters.push_back({path, std::move(getter), options});
+      schema.clear();
+
+      return true;
+   }
+
+   // define an image var - the getter returns width x height pixels in the given format
+   //
+   //   image("camera", [](auto ) { return view(pixels); }, { .width = 640, .height = 480 });
+   //
+   // the type and the shape of the var are set to [height, width, channels]
+   bool image(const std::string& path, TGetter&& getter, ImageOptions image, VarOptions options = {})
+   {
+      const auto format = image.format;
+      options.type = format == PixelFormat::Gray16    ? ElementType::UInt16
+                     : format == PixelFormat::Float32 ? ElementType::Float32
+                                                      : ElementType::UInt8;
+      options.shape = {image.height, image.width, format == PixelFormat::RGB8 ? 3 : format == PixelFormat::RGBA8 ? 4 : 1};
+      options.image = image;
+
+      return var(path, std::move(getter), std::move(options));
+   }
+
+   static int32_t pixelSize(PixelFormat format)
+   {
+      switch (format) {
+      case PixelFormat::Gray8:
+         return 1;
+      case PixelFormat::RGB8:
+         return 3;
+      case PixelFormat::Gray16:
+         return 2;
+      default:
+         return 4;
+      }
+   }
+
+   // define a var that the clients can also write to
+   //
+   // examples:
+   //
+   //   var("gain", [](auto ) { return view(gain); }, [](auto , std::string_view data) { ... });
+   //   var("gain", [](auto ) { return view(gain); }, setter<float>([](auto , float v) { gain = v; }));
+   //   var("eq[%d]", [](auto idxs) { ... }, setter<float>([](auto idxs, float v) { eq[idxs[0]] = v; }));
+   //
+   // the setters run in applyWrites(), or on the service loop with Parameters::applyWritesOnLoop
+   bool var(const std::string& path, TGetter&& getter, TSetter&& setter, VarOptions options = {})
+   {
+      var(path, std::move(getter), options);
+      getters.back().setter = std::move(setter);
+
+      return true;
+   }
+
+   // setter for trivially copyable values - writes of a different size are ignored
+   template <class T, class F>
+      requires(std::is_trivially_copyable_v<T>)
+   static TSetter setter(F&& f)
+   {
+      return [f = std::forward<F>(f)](const std::vector<int>& idxs, std::string_view data) {
+         if (data.size() < sizeof(T)) {
+            return;
+         }
+
+         T value{};
+         std::memcpy(&value, data.data(), sizeof(T));
+         f(idxs, value);
+      };
+   }
+
+   // run the setters of the writes received from the clients since the last call
+   // call it from the thread that owns the vars at a point where they can change, e.g. once per iteration of the
+   // main loop of the application. returns the number of applied writes
+   int32_t applyWrites()
+   {
+      int32_t n = 0;
+      while (writes.pop(pendingWrite)) {
+         applyWrite(pendingWrite);
+         ++n;
+      }
+
+      return n;
+   }
+
+   // define a var computed on the service from the vars matched by a pattern
+   // the elements of the matched vars are read as the element type of their getter - float32 for raw vars
+   // the result is computed at most once per update and shared by all clients
+   //
+   // examples:
+   //
+   //   derive("stats.vx_max", "state.ball[*].vx", { .reduction = Reduction::Max });
+   //   derive("stats.vx_hist", "state.ball[*].vx", { .reduction = Reduction::Histogram, .bins = 32, .lo = -1.0 });
+   //   derive("stats.row_sum[%d]", "grid[%d].cell[*]", { .reduction = Reduction::Sum });
+   //
+   bool derive(const std::string& path, const std::string& source, DeriveOptions options = {})
+   {
+      VarOptions varOptions = typed<double>();
+      varOptions.tBudget_us = 0; // the cache is not thread-safe
+      if (options.reduction == Reduction::Histogram) {
+         options.bins = std::max(options.bins, 1);
+         varOptions.type = ElementType::UInt32;
+         varOptions.shape = {options.bins};
+      }
+      else if (options.reduction == Reduction::TopK) {
+         options.k = std::max(options.k, 1);
+         varOptions.shape = {options.k, 2};
+      }
+
+      const size_t derivedId = derived.size();
+      derived.push_back(std::make_unique<Derived>());
+      derived.back()->source = source;
+      derived.back()->options = options;
+
+      return var(path, [this, derivedId](const std::vector<int>& idxs) { return evaluateDerived(*derived[derivedId], idxs); },
+                 std::move(varOptions));
+   }
+
+   // report that the var at `path` (e.g. "state.ball[3].vx") changed - used by the incremental derived vars
+   // an empty path recomputes all derived vars from scratch
+   // can be called from any thread - the invalidations are queued and applied at the start of the next update. past
+   // kMaxInvalidations queued paths, the derived vars are recomputed from scratch instead
+   void invalidate(std::string_view path = {})
+   {
+      std::lock_guard lock(invalidMutex);
+      if (isInvalidAll) {
+         return;
+      }
+
+      if (path.empty() || nInvalidations == kMaxInvalidations) {
+         isInvalidAll = true;
+         nInvalidations = 0;
+         return;
+      }
+
+      // the strings are reused, so the queue does not allocate once it has grown
+      if (nInvalidations == invalidations.size()) {
+         invalidations.emplace_back();
+      }
+      invalidations[nInvalidations++] = path;
+   }
+
+   // define the number of elements of an array, used to expand "[*]" wildcards in client requests
+   //
+   // examples:
+   //
+   //   extent("state.ball", [](auto ) { return balls.size(); });  // state.ball[*].x
+   //   extent("grid[%d].cell", [](auto idxs) { return rows[idxs[0]].size(); });  // grid[%d].cell[*]
+   //
+   bool extent(const std::string& path, TExtent&& extent) { return pathTrie.setExtent(path, std::move(extent)); }
+
+   // define a remote procedure that the clients can call via incppect.call(name, payload)
+   // the returned string is sent back to the calling client as the response payload
+   //
+   // examples:
    //
-   bool var(const std::string& path, TGetter&& getter)
+   //   rpc("echo", [](int32_t clientId, std::string_view payload) { return std::string(payload); });
+   //   rpc("render", [](int32_t clientId, std::string_view payload) { ... }, { .async = true });
+   //
+   bool rpc(const std::string& name, TRpcHandler&& handler, RpcOptions options = {})
    {
-      pathToGetter[path] = getters.size();
-      getters.emplace_back(std::move(getter));
+      rpcs[name] = {std::move(handler), options};
 
       return true;
    }
 
+   // typed version for trivially copyable request and response types:
+   //
+   //   rpc<Vec2, float>("length", [](int32_t clientId, const Vec2& v) { return std::hypot(v.x, v.y); });
+   //
+   template <class TReq, class TResp, class F>
+      requires(std::is_trivially_copyable_v<TReq> && std::is_trivially_copyable_v<TResp>)
+   bool rpc(const std::string& name, F&& handler, RpcOptions options = {})
+   {
+      return rpc(
+         name,
+         [handler = std::forward<F>(handler)](int32_t clientId, std::string_view payload) -> std::string {
+            if (payload.size() < sizeof(TReq)) {
+               return {};
+            }
+
+            TReq req{};
+            std::memcpy(&req, payload.data(), sizeof(TReq));
+
+            const TResp resp = handler(clientId, req);
+            return std::string((const char*)(&resp), sizeof(TResp));
+         },
+         options);
+   }
+
+   // JSON list of the registered vars:
+   //
+   //   [{"path":"state.ball[%d].x","type":"float32","shape":[],"endianness":"little"},...]
+   //
+   std::string listVars() const
+   {
+      std::string res = "[";
+      for (int32_t getterId = 0; getterId < int32_t(getters.size()); ++getterId) {
+         const auto& path = getters[getterId].path;
+         if (pathTrie.find(path) != getterId) {
+            // re-registered path
+            continue;
+         }
+
+         if (res.size() > 1) {
+            res += ',';
+         }
+         static constexpr const char* kTypeNames[] = {"raw",    "int8",   "uint8",   "int16",   "uint16", "int32",
+                                                       "uint32", "int64",  "uint64",  "float32", "float64", "string"};
+
+         const auto& options = getters[getterId].options;
+
+         res += "{\"path\":\"";
+         for (const char c : path) {
+            if (c == '"' || c == '\\') {
+               res += '\\';
+            }
+            res += c;
+         }
+         res += "\",\"type\":\"";
+         res += kTypeNames[int(options.type)];
+         res += "\",\"shape\":[";
+         for (size_t i = 0; i < options.shape.size(); ++i) {
+            res += (i > 0 ? "," : "") + std::to_string(options.shape[i]);
+         }
+         res += "],\"endianness\":\"";
+         res += options.endianness == Endianness::Little ? "little" : "big";
+         res += getters[getterId].setter ? "\",\"settable\":true}" : "\"}";
+      }
+      res += "]";
+
+      return res;
+   }
+
+   // element type of a C++ type
+   template <class T>
+   static constexpr ElementType elementType()
+   {
+      using U = std::remove_cvref_t<std::remove_all_extents_t<T>>;
+      if constexpr (std::is_same_v<U, int8_t> || std::is_same_v<U, char>) return ElementType::Int8;
+      else if constexpr (std::is_same_v<U, uint8_t>) return ElementType::UInt8;
+      else if constexpr (std::is_same_v<U, int16_t>) return ElementType::Int16;
+      else if constexpr (std::is_same_v<U, uint16_t>) return ElementType::UInt16;
+      else if constexpr (std::is_same_v<U, int32_t>) return ElementType::Int32;
+      else if constexpr (std::is_same_v<U, uint32_t>) return ElementType::UInt32;
+      else if constexpr (std::is_same_v<U, int64_t>) return ElementType::Int64;
+      else if constexpr (std::is_same_v<U, uint64_t>) return ElementType::UInt64;
+      else if constexpr (std::is_same_v<U, float>) return ElementType::Float32;
+      else if constexpr (std::is_same_v<U, double>) return ElementType::Float64;
+      else if constexpr (std::is_same_v<U, std::string>) return ElementType::String;
+      else return ElementType::Raw;
+   }
+
+   // var options for data of type T, e.g. typed<float[16]>() or typed<float>({4, 4})
+   template <class T>
+   static VarOptions typed(std::vector<int32_t> shape = {})
+   {
+      VarOptions options;
+      options.type = elementType<T>();
+      options.shape = std::move(shape);
+      if constexpr (std::is_array_v<T>) {
+         if (options.shape.empty()) {
+            options.shape.push_back(int32_t(std::extent_v<T>));
+         }
+      }
+
+      return options;
+   }
+
    // shorthand for string_view from var
    template <class T>
       requires (std::is_trivially_copyable_v<std::decay_t<T>>)
@@ -154,40 +752,205 @@ struct Incppect
       return std::string_view{(char*)(&t), sizeof(t)};
    }
 
-   // get global instance
+   // get the default instance
+   // more instances can be constructed directly, each with its own vars, clients, parameters and worker threads
    static Incppect& getInstance()
    {
       static Incppect instance;
       return instance;
    }
 
+   struct GetterData
+   {
+      std::string path{};
+      TGetter getter{};
+      VarOptions options{};
+      TSetter setter{};
+   };
+
+   // cached result of a derived var for one set of indices
+   struct DerivedState
+   {
+      bool isValid = false;
+      uint64_t tick = 0;
+
+      std::shared_ptr<IncppectPathTrie::Expansion> expansion{};
+      uint64_t inputsVersion = 0;
+      std::vector<IncppectPathTrie::Match> inputs{};
+      std::vector<uint32_t> offsets{}; // first element of each input in `values`, plus the total
+      std::vector<double> values{};
+      std::vector<uint32_t> dirty{};   // inputs passed to invalidate()
+      std::vector<uint8_t> isDirty{};  // per input, keeps `dirty` free of duplicates
+
+      // running aggregates of `values` for Sum, Mean and Histogram, updated from the re-read inputs
+      // the sum is compensated and excludes the non-finite values, which are counted instead
+      double sum = 0.0;
+      double sumError = 0.0;
+      int64_t nNan = 0;
+      int64_t nPosInf = 0;
+      int64_t nNegInf = 0;
+      std::vector<uint32_t> bins{};
+      uint64_t tickRecomputed = 0;
+      int64_t tLastUsed_ms = 0;
+
+      std::string result{};
+   };
+
+   struct Derived
+   {
+      std::string source{};
+      DeriveOptions options{};
+      std::map<std::vector<int>, DerivedState> states{};
+   };
+
+   // write of a client to a settable var
+   struct Write
+   {
+      int32_t getterId = -1;
+      std::vector<int> idxs{};
+      std::string data{};
+   };
+
+   // latest result of an async getter, shared by all requests with the same getter and indices
+   struct AsyncResult
+   {
+      std::string data{}; // owned by the service loop
+      std::string ready{}; // completed by a worker, guarded by asyncMutex
+      bool hasData = false;
+      bool hasReady = false;
+      bool isPending = false;
+      int64_t tLastUsed_ms = -1;
+   };
+
+   struct RpcData
+   {
+      TRpcHandler handler{};
+      RpcOptions options{};
+   };
+
    struct Request
    {
+      Priority priority = Priority::Normal;
+
       int64_t tLastUpdated_ms = -1;
+      bool isActive = false; // kept alive by the keepalive messages of the client
       int64_t tLastRequested_ms = -1;
-      int64_t tMinUpdate_ms = 16;
       int64_t tLastRequestTimeout_ms = 3000;
 
+      // update interval requested by the client
+      // tMinUpdate_ms : -1 - Parameters::tMinUpdate_ms, clamped to at least Parameters::tMinUpdate_ms
+      // tMaxUpdate_ms : -1 - no deadline, otherwise overdue requests are served with high priority
+      int64_t tMinUpdate_ms = -1;
+      int64_t tMaxUpdate_ms = -1;
+
       std::vector<int> idxs{};
+      uint32_t clientIdxs = 0; // bit i is set if idxs[i] is the id of the client (-1 in the request)
       int32_t getterId = -1;
 
+      // wildcard requests are expanded into a batch of vars that are sent as a single record
+      std::string pattern{};
+      std::vector<IncppectPathTrie::Match> batch{};
+      std::shared_ptr<IncppectPathTrie::Expansion> expansion{};
+      uint64_t batchVersion = 0;
+      std::string batchData{};
+      bool batchChanged = false;
+
       std::string prevData{};
       std::string diffData{};
       std::string_view curData{};
+
+      // send full records until the next complete update, since the client state can no longer be trusted
+      bool keyframe = false;
+
+      // lossy encoding of the values, requested by the client - quantData holds the encoded values
+      uint32_t quantization = IncppectCodec::None;
+      float quantizationScale = 1.0f;
+      float quantizationOffset = 0.0f;
+      std::string quantData{};
+
+      // filter requested by the client - only the elements that pass it are sent, as (index, value) pairs
+      // sparseIdxs/sparseValues hold the set that was sent last
+      uint32_t filter = IncppectCodec::NoFilter;
+      double filterA = 0.0;
+      double filterB = 0.0;
+      std::vector<uint32_t> sparseIdxs{};
+      std::vector<double> sparseValues{};
+
+      // small vars are sent in the bundle of the client, prevData holds the value for it
+      bool isBundled = false;
+      bool isBundleDue = false;
+
+      // snapshot of a var larger than maxChunkSize_bytes that is currently being streamed
+      std::string streamData{};
+      uint32_t streamOffset = 0;
+
+      // the delta state was evicted - it is not kept until then, see Parameters::tDeltaCooldown_ms
+      int64_t tDeltaCooldownEnd_ms = -1;
    };
 
+   // every frame starts with [typeAll][seq][timestamp in us, 8 bytes]
+   static constexpr uint32_t kFrameHeader_bytes = IncppectCodec::kFrameHeader_bytes;
+
+   // round trip histogram - bucket i counts the round trips shorter than 2^(i + 7) us, the last one the rest
+   static constexpr int32_t kRttBuckets = 16;
+
    struct ClientData
    {
       int64_t tConnected_ms = -1;
 
       std::array<uint8_t, 4> ipAddress{};
 
-      std::vector<int32_t> lastRequests{};
+      // transport of the client - websocket or unix domain socket
+      std::function<bool(std::string_view data, bool doCompress)> send{};
+      std::function<int32_t()> getBufferedAmount{};
+      std::function<void()> close{};
+
+      int64_t tLastKeepalive_ms = -1;
       std::map<int32_t, Request> requests{};
 
       std::string curBuffer{};
       std::string prevBuffer{};
       std::string diffBuffer{};
+
+      // bandwidth budget
+      int64_t txBudget_bytes_per_s = -1;
+      int64_t tLastCredit_ms = -1;
+      double txCredit_bytes = 0.0;
+
+      // requests due in the current update, per priority class
+      std::array<std::vector<std::pair<int32_t, Request*>>, 3> dueRequests{};
+      // last served request per priority class - budgeted classes continue after it on the next update
+      std::array<int32_t, 3> lastServedRequestId{};
+
+      // layout of the bundle last sent to the client - [requestId, size]...
+      std::vector<uint32_t> bundleLayout{};
+      std::vector<uint32_t> bundleLayoutNew{};
+
+      // the next frame is a keyframe - set for new clients and when a client loses track of the delta stream
+      bool keyframe = true;
+      int64_t tLastKeyframe_ms = -1;
+
+      // memory accounting
+      int64_t deltaState_bytes = 0;
+      bool isRequestLimitReported = false;
+
+      // identifies the client when it reconnects, see Parameters::tSessionGrace_ms
+      int32_t clientId = -1;
+      uint64_t sessionToken = 0;
+
+      // frame sequence and acknowledgements
+      uint32_t seq = 0;
+      uint32_t seqAcked = 0;
+      int32_t nFramesInFlight = 0;
+      int32_t rtt_us = -1; // smoothed round trip time
+      std::array<uint32_t, kRttBuckets> rttHist{};
+   };
+
+   // client state kept after a disconnect
+   struct Session
+   {
+      ClientData cd{};
+      int64_t tClosed_ms = -1;
    };
 
    struct PerSocketData
@@ -208,8 +971,6 @@ struct Incppect
 
    void run()
    {
-      mainLoop = uWS::Loop::get();
-
       {
          const char* kProtocol = SSL ? "HTTPS" : "HTTP";
          if (print_debug) {
@@ -217,139 +978,278 @@ struct Incppect
          }
       }
 
-      typename uWS::TemplatedApp<SSL>::WebSocketBehavior wsBehaviour;
-      wsBehaviour.compression = uWS::SHARED_COMPRESSOR;
-      //wsBehaviour.compression = uWS::DEDICATED_COMPRESSOR_256KB;
-      wsBehaviour.maxPayloadLength = parameters.maxPayloadLength_bytes;
-      wsBehaviour.idleTimeout = parameters.tIdleTimeout_s;
-      wsBehaviour.open = [&](auto* ws, auto* /*req*/) {
-         static int32_t uniqueId = 1;
-         ++uniqueId;
-
-         auto& cd = clientData[uniqueId];
-         cd.tConnected_ms = timestamp();
+      std::unique_ptr<uWS::TemplatedApp<SSL>> app;
 
-         auto addressBytes = ws->getRemoteAddress();
-         cd.ipAddress[0] = addressBytes[12];
-         cd.ipAddress[1] = addressBytes[13];
-         cd.ipAddress[2] = addressBytes[14];
-         cd.ipAddress[3] = addressBytes[15];
+      if constexpr (SSL) {
+         us_socket_context_options_t ssl_options = {};
 
-         auto sd = static_cast<PerSocketData*>(ws->getUserData());
-         sd->clientId = uniqueId;
-         sd->ws = ws;
-         sd->mainLoop = uWS::Loop::get();
+         ssl_options.key_file_name = parameters.sslKey.data();
+         ssl_options.cert_file_name = parameters.sslCert.data();
 
-         socketData.insert({uniqueId, sd});
+         app.reset(new uWS::TemplatedApp<SSL>(ssl_options));
+      }
+      else {
+         app.reset(new uWS::TemplatedApp<SSL>());
+      }
 
+      if (app->constructorFailed()) {
          if (print_debug) {
-            std::printf("[incppect] client with id = %d connected\n", sd->clientId);
+            std::printf("[incppect] failed to construct uWS server!\n");
+            if (SSL) {
+               std::printf("[incppect] verify that you have valid certificate files:\n");
+               std::printf("[incppect] key  file : '%s'\n", parameters.sslKey.c_str());
+               std::printf("[incppect] cert file : '%s'\n", parameters.sslCert.c_str());
+            }
          }
 
-         if (handler) {
-            handler(sd->clientId, EventType::Connect, {(const char*)cd.ipAddress.data(), cd.ipAddress.size()});
-         }
-      };
-      wsBehaviour.message = [this](auto* ws, const std::string_view message, uWS::OpCode /*opCode*/) {
-         rxTotal_bytes += message.size();
-         if (message.size() < sizeof(int)) {
-            return;
+         {
+            std::lock_guard lock(loopMutex);
+            isServing = false;
          }
+         notifyStarted();
+         return;
+      }
 
-         uint32_t type{};
-         std::memcpy(&type, message.data(), sizeof(type));
-
-         bool doUpdate = true;
+      attach(*app);
 
-         auto sd = static_cast<PerSocketData*>(ws->getUserData());
-         auto& cd = clientData[sd->clientId];
-
-         switch (type) {
-         case 1: {
-            // Custom space delimited format parsing
-            // TODO: replace with BEVE
-            std::stringstream ss(message.data() + 4);
-            while (true) {
-               Request request;
-
-               std::string path;
-               ss >> path;
-               if (ss.eof()) break;
-               int requestId = 0;
-               ss >> requestId;
-               int nidxs = 0;
-               ss >> nidxs;
-               for (int i = 0; i < nidxs; ++i) {
-                  int idx = 0;
-                  ss >> idx;
-                  if (idx == -1) idx = sd->clientId;
-                  request.idxs.push_back(idx);
-               }
+      (*app).get("/*", [this](auto* res, auto* req) {
+         const std::string_view url{req->getUrl()};
+         std::printf("url = '%.*s'\n", int(url.size()), url.data());
+
+         res->end("Resource not found");
+         return;
+      });
+      (*app).listen(parameters.portListen, [this](auto* token) {
+         this->listenSocket = token;
+         if (token == nullptr) {
+            std::printf("[incppect] failed to listen on port %d\n", parameters.portListen);
+         }
+         else {
+            std::printf("[incppect] listening on port %d, route '%s'\n", parameters.portListen,
+                        parameters.route.c_str());
 
-               if (const auto it = pathToGetter.find(path); it != pathToGetter.end()) {
-                  if (print_debug) {
-                     std::printf("[incppect] requestId = %d, path = '%s', nidxs = %d\n", requestId, path.c_str(), nidxs);
-                  }
-                  request.getterId = it->second;
+            const char* kProtocol = SSL ? "https" : "http";
+            std::printf("[incppect] %s://localhost:%d/\n", kProtocol, parameters.portListen);
+         }
+      });
 
-                  cd.requests[requestId] = std::move(request);
-               }
-               else {
-                  if (print_debug) {
-                     std::printf("[incppect] missing path '%s'\n", path.c_str());
-                  }
-               }
+      running = listenSocket != nullptr;
+      notifyStarted();
+
+      if (running) {
+         (*app).run();
+         running = false;
+      }
+      else {
+         closeAll();
+      }
+
+      {
+         std::lock_guard lock(loopMutex);
+         mainLoop = nullptr;
+      }
+
+      // clients whose close events did not make it to the loop before it exited
+      socketData.clear();
+      while (clientData.empty() == false) {
+         onClose(clientData.begin()->first);
+      }
+
+      std::lock_guard lock(loopMutex);
+      isServing = false;
+      if (pendingParameters) {
+         parameters = std::move(*pendingParameters);
+         pendingParameters.reset();
+      }
+   }
+
+   // wake up start(), once run() listens or failed to
+   void notifyStarted()
+   {
+      {
+         std::lock_guard lock(loopMutex);
+         isStarting = false;
+      }
+      startedCv.notify_all();
+   }
+
+   // close the connections, the listen socket and the local transports - the loop exits once they are closed
+   void closeAll()
+   {
+      if (drainTimer != nullptr) {
+         us_timer_close(drainTimer);
+         drainTimer = nullptr;
+      }
+
+      // deferred, since closing a connection erases it from clientData. the clients are looked up again, as they can
+      // disconnect before the tasks run
+      for (const auto& [clientId, cd] : clientData) {
+         mainLoop->defer([this, clientId = clientId]() {
+            if (const auto it = clientData.find(clientId); it != clientData.end() && it->second.close) {
+               it->second.close();
             }
-         } break;
-         case 2: {
-            const auto nRequests = (message.size() - sizeof(int32_t)) / sizeof(int32_t);
-            if (nRequests * sizeof(int32_t) + sizeof(int32_t) != message.size()) {
-               if (print_debug) {
-                  std::printf("[incppect] error : invalid message data!\n");
-               }
+         });
+      }
+      if (listenSocket != nullptr) {
+         us_listen_socket_close(SSL, listenSocket);
+         listenSocket = nullptr;
+      }
+
+      localServer.stop();
+      if (shmTimer != nullptr) {
+         us_timer_close(shmTimer);
+         shmTimer = nullptr;
+      }
+      shmWriter.close();
+
+      // finish the async getters and rpcs while the loop can still take their results
+      workers.stop();
+   }
+
+   // hand a task over to the service loop from any thread
+   // returns false and drops the task if the loop is not running
+   bool deferToLoop(std::function<void()>&& task)
+   {
+      std::lock_guard lock(loopMutex);
+      if (mainLoop == nullptr) {
+         return false;
+      }
+
+      mainLoop->defer(std::move(task));
+      return true;
+   }
+
+   // stop accepting clients and flush the pending frames, see shutdown()
+   void drain(int64_t tDrain_ms)
+   {
+      if (listenSocket != nullptr) {
+         us_listen_socket_close(SSL, listenSocket);
+         listenSocket = nullptr;
+      }
+      if (drainTimer != nullptr) {
+         return;
+      }
+
+      update();
+
+      tDrainEnd_ms = timestamp() + tDrain_ms;
+      drainTimer = us_create_timer((us_loop_t*)(mainLoop), 0, sizeof(Incppect*));
+      *(Incppect**)(us_timer_ext(drainTimer)) = this;
+      us_timer_set(
+         drainTimer, [](us_timer_t* timer) { (*(Incppect**)(us_timer_ext(timer)))->checkDrained(); }, 1, 10);
+   }
+
+   void checkDrained()
+   {
+      if (timestamp() < tDrainEnd_ms) {
+         for (const auto& [clientId, cd] : clientData) {
+            if (cd.getBufferedAmount && cd.getBufferedAmount() > 0) {
                return;
             }
-            if (print_debug) {
-               std::printf("[incppect] received requests: %d\n", int(nRequests));
-            }
+         }
+      }
 
-            cd.lastRequests.clear();
-            for (size_t i = 0; i < nRequests; ++i) {
-               int32_t curRequest = -1;
-               std::memcpy(&curRequest, message.data() + 4 * (i + 1), sizeof(curRequest));
-               if (cd.requests.find(curRequest) != cd.requests.end()) {
-                  cd.lastRequests.push_back(curRequest);
-                  cd.requests[curRequest].tLastRequested_ms = timestamp();
-                  cd.requests[curRequest].tLastRequestTimeout_ms = parameters.tLastRequestTimeout_ms;
-               }
-            }
-         } break;
-         case 3: {
-            // update time stamps
-            for (auto curRequest : cd.lastRequests) {
-               if (cd.requests.find(curRequest) != cd.requests.end()) {
-                  cd.requests[curRequest].tLastRequested_ms = timestamp();
-                  cd.requests[curRequest].tLastRequestTimeout_ms = parameters.tLastRequestTimeout_ms;
-               }
-            }
-         } break;
-         case 4: {
-            // Custom event
-            doUpdate = false;
-            if (handler && message.size() > sizeof(int32_t)) {
-               handler(sd->clientId, EventType::Custom, {message.data() + sizeof(int32_t), message.size() - sizeof(int32_t)});
-            }
-         } break;
-         default:
-               if (print_debug) {
-                  std::printf("[incppect] unknown message type: %d\n", type);
-               }
+      closeAll();
+   }
+
+   // replace the parameters between two updates, keeping the ones that the server was set up with
+   void applyParameters(Parameters next)
+   {
+      next.portListen = parameters.portListen;
+      next.maxPayloadLength_bytes = parameters.maxPayloadLength_bytes;
+      next.tIdleTimeout_s = parameters.tIdleTimeout_s;
+      next.nWorkers = parameters.nWorkers;
+      next.unixSocketPath = std::move(parameters.unixSocketPath);
+      next.localAccessMode = parameters.localAccessMode;
+      next.shmName = std::move(parameters.shmName);
+      next.shmCapacity_bytes = parameters.shmCapacity_bytes;
+      next.tShmUpdate_ms = parameters.tShmUpdate_ms;
+      next.route = std::move(parameters.route);
+      next.httpRoot = std::move(parameters.httpRoot);
+      next.resources = std::move(parameters.resources);
+      next.sslKey = std::move(parameters.sslKey);
+      next.sslCert = std::move(parameters.sslCert);
+
+      // the chunks and the bundles of the clients are laid out for the old sizes - resynchronize them
+      const bool isLayoutChanged = next.maxChunkSize_bytes != parameters.maxChunkSize_bytes ||
+                                   next.maxBundledSize_bytes != parameters.maxBundledSize_bytes;
+
+      parameters = std::move(next);
+
+      if (isLayoutChanged) {
+         for (auto& [clientId, cd] : clientData) {
+            cd.keyframe = true;
+         }
+      }
+
+      if (print_debug) {
+         std::printf("[incppect] parameters updated\n");
+      }
+   }
+
+   void attach(uWS::TemplatedApp<SSL>& app)
+   {
+      {
+         std::lock_guard lock(loopMutex);
+         mainLoop = uWS::Loop::get();
+
+         // parameters passed to reconfigure() while the service was starting
+         if (pendingParameters) {
+            mainLoop->defer([this, parameters = std::move(*pendingParameters)]() mutable {
+               applyParameters(std::move(parameters));
+            });
+            pendingParameters.reset();
+         }
+      }
+
+      if (parameters.route.empty() || parameters.route[0] != '/') {
+         parameters.route.insert(0, "/");
+      }
+
+      typename uWS::TemplatedApp<SSL>::WebSocketBehavior wsBehaviour;
+      wsBehaviour.compression = uWS::SHARED_COMPRESSOR;
+      //wsBehaviour.compression = uWS::DEDICATED_COMPRESSOR_256KB;
+      wsBehaviour.maxPayloadLength = parameters.maxPayloadLength_bytes;
+      wsBehaviour.idleTimeout = parameters.tIdleTimeout_s;
+      wsBehaviour.open = [this](auto* ws, auto* /*req*/) {
+         const int32_t uniqueId = ++lastClientId;
+
+         auto& cd = clientData[uniqueId];
+         cd.clientId = uniqueId;
+         cd.tConnected_ms = timestamp();
+         cd.send = [ws](std::string_view data, bool doCompress) {
+            return ws->send(data, uWS::OpCode::BINARY, doCompress);
          };
+         cd.getBufferedAmount = [ws]() { return int32_t(ws->getBufferedAmount()); };
+         cd.close = [ws]() { ws->close(); };
+
+         auto addressBytes = ws->getRemoteAddress();
+         cd.ipAddress[0] = addressBytes[12];
+         cd.ipAddress[1] = addressBytes[13];
+         cd.ipAddress[2] = addressBytes[14];
+         cd.ipAddress[3] = addressBytes[15];
+
+         auto sd = static_cast<PerSocketData*>(ws->getUserData());
+         sd->clientId = uniqueId;
+         sd->ws = ws;
+         sd->mainLoop = uWS::Loop::get();
+
+         socketData.insert({uniqueId, sd});
+
+         startSession(cd);
 
-         if (doUpdate) {
-            sd->mainLoop->defer([this]() { update(); });
+         if (print_debug) {
+            std::printf("[incppect] client with id = %d connected\n", sd->clientId);
+         }
+
+         if (handler) {
+            handler(sd->clientId, EventType::Connect, {(const char*)cd.ipAddress.data(), cd.ipAddress.size()});
          }
       };
+      wsBehaviour.message = [this](auto* ws, const std::string_view message, uWS::OpCode /*opCode*/) {
+         auto sd = static_cast<PerSocketData*>(ws->getUserData());
+         onMessage(sd->clientId, message);
+      };
       wsBehaviour.drain = [this](auto* ws) {
          /* Check getBufferedAmount here */
          if (print_debug && ws->getBufferedAmount() > 0) {
@@ -364,50 +1264,20 @@ struct Incppect
       };
       wsBehaviour.close = [this](auto* ws, int /*code*/, std::string_view /*message*/) {
          auto sd = static_cast<PerSocketData*>(ws->getUserData());
-         if (print_debug) {
-            std::printf("[incppect] client with id = %d disconnected\n", sd->clientId);
-         }
-
-         clientData.erase(sd->clientId);
          socketData.erase(sd->clientId);
 
-         if (handler) {
-            handler(sd->clientId, EventType::Disconnect, {nullptr, 0});
-         }
+         onClose(sd->clientId);
       };
 
-      std::unique_ptr<uWS::TemplatedApp<SSL>> app;
-
-      if constexpr (SSL) {
-         us_socket_context_options_t ssl_options = {};
-
-         ssl_options.key_file_name = parameters.sslKey.data();
-         ssl_options.cert_file_name = parameters.sslCert.data();
-
-         app.reset(new uWS::TemplatedApp<SSL>(ssl_options));
-      }
-      else {
-         app.reset(new uWS::TemplatedApp<SSL>());
-      }
-
-      if (app->constructorFailed()) {
-         if (print_debug) {
-            std::printf("[incppect] failed to construct uWS server!\n");
-            if (SSL) {
-               std::printf("[incppect] verify that you have valid certificate files:\n");
-               std::printf("[incppect] key  file : '%s'\n", parameters.sslKey.c_str());
-               std::printf("[incppect] cert file : '%s'\n", parameters.sslCert.c_str());
-            }
-         }
-
-         return;
-      }
-
-      (*app)
-         .template ws<PerSocketData>("/incppect", std::move(wsBehaviour))
-         .get("/incppect.js", [](auto* res, auto* /*req*/) { res->end(kIncppect_js); });
+      app
+         .template ws<PerSocketData>(parameters.route, std::move(wsBehaviour))
+         .get(parameters.route + ".js", [](auto* res, auto* /*req*/) { res->end(kIncppect_js); })
+         .get(parameters.route + "/vars", [this](auto* res, auto* /*req*/) {
+            res->writeHeader("Content-Type", "application/json");
+            res->end(listVars());
+         });
       for (const auto& resource : parameters.resources) {
-         (*app).get("/" + resource, [this](auto* res, auto* req) {
+         app.get("/" + resource, [this](auto* res, auto* req) {
             std::string url = std::string(req->getUrl());
             std::printf("url = '%s'\n", url.c_str());
 
@@ -448,222 +1318,2018 @@ struct Incppect
             res->end(str);
          });
       }
-      (*app).get("/*", [this](auto* res, auto* req) {
-         const std::string_view url{req->getUrl()};
-         std::printf("url = '%.*s'\n", int(url.size()), url.data());
+      startLocalTransports();
+   }
 
-         res->end("Resource not found");
+   // start the unix domain socket and the shared memory snapshot, if they are configured
+   void startLocalTransports()
+   {
+      if (parameters.unixSocketPath.empty() == false) {
+         IncppectLocalServer::Callbacks callbacks;
+
+         // the callbacks run on the thread of the local server - the events are handed over to the service loop
+         callbacks.onOpen = [this]() {
+            const int32_t clientId = ++lastClientId;
+            deferToLoop([this, clientId]() {
+               auto& cd = clientData[clientId];
+               cd.clientId = clientId;
+               cd.tConnected_ms = timestamp();
+               cd.ipAddress = {127, 0, 0, 1};
+               cd.send = [this, clientId](std::string_view data, bool /*doCompress*/) {
+                  return localServer.send(clientId, data);
+               };
+               cd.getBufferedAmount = [this, clientId]() { return localServer.getBufferedAmount(clientId); };
+               cd.close = [this, clientId]() { localServer.close(clientId); };
+
+               startSession(cd);
+
+               if (print_debug) {
+                  std::printf("[incppect] local client with id = %d connected\n", clientId);
+               }
+
+               if (handler) {
+                  handler(clientId, EventType::Connect, {(const char*)cd.ipAddress.data(), cd.ipAddress.size()});
+               }
+            });
+            return clientId;
+         };
+         callbacks.onMessage = [this](int32_t clientId, std::string&& message) {
+            deferToLoop([this, clientId, message = std::move(message)]() { onMessage(clientId, message); });
+         };
+         callbacks.onClose = [this](int32_t clientId) { deferToLoop([this, clientId]() { onClose(clientId); }); };
+
+         // a full frame always fits, even if the limit is lower
+         const uint64_t maxBuffered_bytes = uint64_t(std::max<int64_t>(
+            parameters.maxLocalBuffered_bytes, int64_t(parameters.maxPayloadLength_bytes) + int64_t(sizeof(uint32_t))));
+         if (localServer.start(parameters.unixSocketPath, std::move(callbacks),
+                               uint32_t(parameters.maxPayloadLength_bytes), maxBuffered_bytes,
+                               parameters.localAccessMode)) {
+            std::printf("[incppect] listening on unix socket '%s'\n", parameters.unixSocketPath.c_str());
+         }
+         else {
+            std::printf("[incppect] failed to listen on unix socket '%s'\n", parameters.unixSocketPath.c_str());
+         }
+      }
+
+      if (parameters.shmName.empty() == false) {
+         if (shmWriter.open(parameters.shmName, uint64_t(parameters.shmCapacity_bytes), parameters.localAccessMode) ==
+             false) {
+            std::printf("[incppect] failed to create shared memory '%s'\n", parameters.shmName.c_str());
+            return;
+         }
+
+         const uint64_t tUpdate_ms = uint64_t(std::max(parameters.tShmUpdate_ms, int64_t(1)));
+         shmTimer = us_create_timer((us_loop_t*)(mainLoop), 0, sizeof(Incppect*));
+         *(Incppect**)(us_timer_ext(shmTimer)) = this;
+         us_timer_set(
+            shmTimer, [](us_timer_t* timer) { (*(Incppect**)(us_timer_ext(timer)))->updateShm(); }, int(tUpdate_ms),
+            int(tUpdate_ms));
+      }
+   }
+
+   // publish the vars in Parameters::shmVars to the shared memory snapshot
+   void updateShm()
+   {
+      if (shmWriter.isOpen() == false) {
          return;
-      });
-      (*app)
-         .listen(parameters.portListen,
-                 [this](auto* token) {
-                    this->listenSocket = token;
-                    if (token) {
-                       std::printf("[incppect] listening on port %d\n", parameters.portListen);
+      }
 
-                       const char* kProtocol = SSL ? "https" : "http";
-                       std::printf("[incppect] %s://localhost:%d/\n", kProtocol, parameters.portListen);
-                    }
-                 })
-         .run();
+      // the expansions are refreshed every time, since the extents of the arrays can change
+      if (shmVars != parameters.shmVars) {
+         shmVars = parameters.shmVars;
+         shmExpansions.clear();
+         for (const auto& path : shmVars) {
+            IncppectPathTrie::parse(path, shmPattern, shmIdxs);
+            shmExpansions.push_back(getExpansion(shmPattern, shmIdxs));
+         }
+      }
+
+      shmWriter.begin();
+      for (const auto& expansion : shmExpansions) {
+         pathTrie.refresh(*expansion);
+         if (addShm(expansion->matches) == false) {
+            break;
+         }
+      }
+      shmWriter.end(timestamp_us());
    }
 
-   void update()
+   bool addShm(const std::vector<IncppectPathTrie::Match>& matches)
    {
-      for (auto& [clientId, cd] : clientData) {
-         if (socketData[clientId]->ws->getBufferedAmount()) {
-            std::printf(
-               "[incppect] warning: buffered amount = %d, not sending updates to client %d. waiting for buffer to "
-               "drain\n",
-               socketData[clientId]->ws->getBufferedAmount(), clientId);
+      for (const auto& match : matches) {
+         std::string_view data;
+         if (evaluate(match.id, match.idxs, data) == false) {
             continue;
          }
 
-         auto& curBuffer = cd.curBuffer;
-         auto& prevBuffer = cd.prevBuffer;
-         auto& diffBuffer = cd.diffBuffer;
-
-         uint32_t typeAll = 0;
-         curBuffer.resize(sizeof(typeAll));
-         std::memcpy(curBuffer.data(), &typeAll, sizeof(typeAll));
+         if (shmWriter.add(match.path, data) == false) {
+            if (print_debug) {
+               std::printf("[incppect] warning: shared memory is full, '%s' and the vars after it are missing\n",
+                           match.path.c_str());
+            }
+            return false;
+         }
+      }
 
-         for (auto& [requestId, req] : cd.requests) {
-            auto& getter = getters[req.getterId];
-            auto tCur = timestamp();
-            if (((req.tLastRequestTimeout_ms < 0 && req.tLastRequested_ms > 0) ||
-                 (tCur - req.tLastRequested_ms < req.tLastRequestTimeout_ms)) &&
-                tCur - req.tLastUpdated_ms > req.tMinUpdate_ms) {
-               if (req.tLastRequestTimeout_ms < 0) {
-                  req.tLastRequested_ms = 0; // resetting last requested time
-               }
+      return true;
+   }
 
-               req.curData = getter(req.idxs);
-               req.tLastUpdated_ms = tCur;
+   // a client of any transport disconnected
+   void onClose(int32_t clientId)
+   {
+      if (print_debug) {
+         std::printf("[incppect] client with id = %d disconnected\n", clientId);
+      }
 
-               constexpr uint32_t kPadding = 4;
+      if (const auto it = clientData.find(clientId); it != clientData.end()) {
+         auto& cd = it->second;
+         if (parameters.tSessionGrace_ms > 0 && cd.sessionToken != 0 && cd.requests.empty() == false) {
+            cd.send = {};
+            cd.getBufferedAmount = {};
+            cd.close = {};
 
-               uint32_t dataSize_bytes = uint32_t(req.curData.size());
-               int padding_bytes = 0;
-               {
-                  int r = dataSize_bytes % kPadding;
-                  while (r > 0 && r < kPadding) {
-                     ++dataSize_bytes;
-                     ++padding_bytes;
-                     ++r;
-                  }
-               }
+            auto& session = sessions[cd.sessionToken];
+            session.cd = std::move(cd);
+            session.tClosed_ms = timestamp();
+         }
+         clientData.erase(it);
+      }
+      pruneSessions();
 
-               int32_t type = 0; // full update
-               if ((req.prevData.size() == (req.curData.size() + padding_bytes)) && (req.curData.size() > 256)) {
-                  type = 1; // run-length encoding of diff
-               }
+      if (handler) {
+         handler(clientId, EventType::Disconnect, {nullptr, 0});
+      }
+   }
 
-               curBuffer.append((char*)(&requestId), sizeof(requestId));
-               curBuffer.append((char*)(&type), sizeof(type));
+   // assign a session token to a new client - it is sent to the client when it asks to resume a session
+   void startSession(ClientData& cd)
+   {
+      if (parameters.tSessionGrace_ms <= 0) {
+         return;
+      }
 
-               if (type == 0) {
-                  curBuffer.append((char*)(&dataSize_bytes), sizeof(dataSize_bytes));
-                  curBuffer.append(req.curData.begin(), req.curData.end());
-                  curBuffer.append(padding_bytes, 0);
-               }
-               else if (type == 1) {
-                  uint32_t a = 0;
-                  uint32_t b = 0;
-                  uint32_t c = 0;
-                  uint32_t n = 0;
-                  req.diffData.clear();
-
-                  constexpr auto chunk_size = sizeof(uint32_t);
-                  for (size_t i = 0; i < req.curData.size(); i += chunk_size) {
-                     std::memcpy(&a, req.prevData.data() + i, chunk_size);
-                     std::memcpy(&b, req.curData.data() + i, chunk_size);
-                     a ^= b;
-                     if (a == c) {
-                        ++n;
-                     }
-                     else {
-                        if (n > 0) {
-                           req.diffData.append((char*)(&n), sizeof(n));
-                           req.diffData.append((char*)(&c), sizeof(c));
-                        }
-                        n = 1;
-                        c = a;
-                     }
-                  }
-
-                  // Handling last few bytes, three or less
-                  if (req.curData.size() % 4 != 0) {
-                     a = 0;
-                     b = 0;
-                     const uint32_t i = uint32_t(req.curData.size()); // (req.curData.size() / 4) * 4
-                     const uint32_t k = uint32_t(req.curData.size() - i);
-                     std::memcpy(&a, req.prevData.data() + i, k);
-                     std::memcpy(&b, req.curData.data() + i, k);
-                     a ^= b;
-                     if (a == c) {
-                        ++n;
-                     }
-                     else {
-                        req.diffData.append((char*)(&n), sizeof(n));
-                        req.diffData.append((char*)(&c), sizeof(c));
-                        n = 1;
-                        c = a;
-                     }
-                  }
-
-                  req.diffData.append((char*)(&n), sizeof(n));
-                  req.diffData.append((char*)(&c), sizeof(c));
-
-                  dataSize_bytes = uint32_t(req.diffData.size());
-                  curBuffer.append((char*)(&dataSize_bytes), sizeof(dataSize_bytes));
-                  curBuffer.append(req.diffData.begin(), req.diffData.end());
-               }
-               
-               req.prevData = req.curData;
-            }
-         }
-
-         if (curBuffer.size() > 4) {
-            if (curBuffer.size() == prevBuffer.size() && curBuffer.size() > 256) {
-               uint32_t a = 0;
-               uint32_t b = 0;
-               uint32_t c = 0;
-               uint32_t n = 0;
-               diffBuffer.clear();
-
-               uint32_t typeAll = 1;
-               diffBuffer.append((char*)(&typeAll), sizeof(typeAll));
-
-               for (int i = 4; i < (int)curBuffer.size(); i += 4) {
-                  std::memcpy(&a, prevBuffer.data() + i, sizeof(uint32_t));
-                  std::memcpy(&b, curBuffer.data() + i, sizeof(uint32_t));
-                  a ^= b;
-                  if (a == c) {
-                     ++n;
-                  }
-                  else {
-                     if (n > 0) {
-                        diffBuffer.append((char*)(&n), sizeof(n));
-                        diffBuffer.append((char*)(&c), sizeof(c));
-                     }
-                     n = 1;
-                     c = a;
-                  }
-               }
+      // the token lets a client take over the session, so every bit of it comes from the system entropy source
+      // instead of a seeded generator whose state can be recovered from the tokens
+      do {
+         cd.sessionToken = (uint64_t(sessionRng()) << 32) | uint64_t(sessionRng());
+      } while (cd.sessionToken == 0 || sessions.count(cd.sessionToken) > 0);
+   }
 
-               diffBuffer.append((char*)(&n), sizeof(n));
-               diffBuffer.append((char*)(&c), sizeof(c));
+   // [typeAll = 5][token, 8 bytes][resumed], the token is 0 if sessions are disabled
+   void sendSession(ClientData& cd, bool isResumed)
+   {
+      const uint32_t typeAll = IncppectCodec::Session;
+      const uint32_t resumed = isResumed ? 1 : 0;
 
-               if (int32_t(diffBuffer.size()) > parameters.maxPayloadLength_bytes) {
-                  std::printf("[incppect] warning: buffer size (%d) exceeds maxPayloadLength (%d)\n",
-                            int(diffBuffer.size()), parameters.maxPayloadLength_bytes);
-               }
+      std::string msg;
+      msg.append((const char*)(&typeAll), sizeof(typeAll));
+      msg.append((const char*)(&cd.sessionToken), sizeof(cd.sessionToken));
+      msg.append((const char*)(&resumed), sizeof(resumed));
+      cd.send(msg, false);
 
-               // compress only for message larger than 64 bytes
-               const bool doCompress = diffBuffer.size() > 64;
+      txTotal_bytes += msg.size();
+   }
 
-               if (socketData[clientId]->ws->send({diffBuffer.data(), diffBuffer.size()}, uWS::OpCode::BINARY,
-                                                  doCompress) == false) {
-                  std::printf("[incpeect] warning: backpressure for client %d increased \n", clientId);
-               }
-            }
-            else {
-               if (int32_t(curBuffer.size()) > parameters.maxPayloadLength_bytes) {
-                  std::printf("[incppect] warning: buffer size (%d) exceeds maxPayloadLength (%d)\n",
-                            int(curBuffer.size()), parameters.maxPayloadLength_bytes);
-               }
+   // continue the session of a previous connection in a new one
+   // the delta state is kept only if the client applied the last frame that was sent to it
+   bool resumeSession(int32_t clientId, ClientData& cd, uint64_t token, uint32_t seqApplied)
+   {
+      pruneSessions();
 
-               // compress only for message larger than 64 bytes
-               const bool doCompress = curBuffer.size() > 64;
+      const auto it = sessions.find(token);
+      if (it == sessions.end() || token == 0) {
+         return false;
+      }
 
-               if (socketData[clientId]->ws->send({curBuffer.data(), curBuffer.size()}, uWS::OpCode::BINARY,
-                                                  doCompress) == false) {
-                  std::printf("[incpeect] warning: backpressure for client %d increased \n", clientId);
-               }
+      auto send = std::move(cd.send);
+      auto getBufferedAmount = std::move(cd.getBufferedAmount);
+      auto close = std::move(cd.close);
+      const auto tConnected_ms = cd.tConnected_ms;
+      const auto ipAddress = cd.ipAddress;
+
+      const auto oldClientId = it->second.cd.clientId;
+      cd = std::move(it->second.cd);
+      sessions.erase(it);
+
+      cd.send = std::move(send);
+      cd.getBufferedAmount = std::move(getBufferedAmount);
+      cd.close = std::move(close);
+      cd.tConnected_ms = tConnected_ms;
+      cd.ipAddress = ipAddress;
+      cd.clientId = clientId;
+      cd.tLastKeepalive_ms = timestamp();
+      cd.tLastCredit_ms = -1;
+      cd.nFramesInFlight = 0;
+      cd.seqAcked = seqApplied;
+
+      // requests for the own connection of the client follow it to the new id
+      for (auto& [requestId, req] : cd.requests) {
+         for (size_t i = 0; i < req.idxs.size() && i < 32; ++i) {
+            if (req.clientIdxs & (1u << i)) {
+               req.idxs[i] = clientId;
             }
-
-            txTotal_bytes += curBuffer.size();
-            
-            prevBuffer = curBuffer;
          }
       }
+
+      if (seqApplied != cd.seq) {
+         cd.keyframe = true;
+      }
+
+      if (print_debug) {
+         std::printf("[incppect] client %d resumed the session of client %d, %s\n", clientId, oldClientId,
+                     cd.keyframe ? "resynchronizing" : "in sync");
+      }
+
+      return true;
    }
 
-   Parameters parameters;
+   void pruneSessions()
+   {
+      const auto tCur = timestamp();
+      std::erase_if(sessions, [&](const auto& item) {
+         return tCur - item.second.tClosed_ms > parameters.tSessionGrace_ms;
+      });
+   }
 
-   double txTotal_bytes = 0.0;
-   double rxTotal_bytes = 0.0;
+   // handle a message from a client - the same protocol is used by all transports
+   // must be called from the thread running the service
+   void onMessage(int32_t clientId, std::string_view message)
+   {
+      rxTotal_bytes += message.size();
+      if (message.size() < sizeof(int)) {
+         return;
+      }
 
-   std::unordered_map<std::string, int> pathToGetter;
-   std::vector<TGetter> getters;
+      uint32_t type{};
+      std::memcpy(&type, message.data(), sizeof(type));
 
-   uWS::Loop* mainLoop = nullptr;
-   us_listen_socket_t* listenSocket = nullptr;
-   std::map<int, PerSocketData*> socketData;
-   std::map<int, ClientData> clientData;
+      bool doUpdate = true;
 
-   std::map<std::string, std::string> resources;
+      if (clientData.count(clientId) == 0) {
+         return;
+      }
+      auto& cd = clientData[clientId];
+
+      switch (type) {
+      case 1: {
+         // Custom space delimited format parsing
+         // TODO: replace with BEVE
+         std::stringstream ss(message.data() + 4);
+         while (true) {
+            Request request;
+
+            std::string path;
+            ss >> path;
+            if (ss.eof()) break;
+            int requestId = 0;
+            ss >> requestId;
+            int nidxs = 0;
+            ss >> nidxs;
+            for (int i = 0; i < nidxs; ++i) {
+               int idx = 0;
+               ss >> idx;
+               if (idx == -1) {
+                  idx = clientId;
+                  request.clientIdxs |= i < 32 ? 1u << i : 0u;
+               }
+               request.idxs.push_back(idx);
+            }
+
+            if (parameters.maxRequestsPerClient > 0 && cd.requests.count(requestId) == 0 &&
+                int32_t(cd.requests.size()) >= parameters.maxRequestsPerClient) {
+               ++nRequestsRejected;
+               if (cd.isRequestLimitReported == false) {
+                  std::printf("[incppect] warning: client %d reached the limit of %d requests, ignoring the rest\n",
+                              clientId, parameters.maxRequestsPerClient);
+                  cd.isRequestLimitReported = true;
+               }
+               continue;
+            }
+
+            if (IncppectPathTrie::isPattern(path)) {
+               if (print_debug) {
+                  std::printf("[incppect] requestId = %d, pattern = '%s', nidxs = %d\n", requestId, path.c_str(), nidxs);
+               }
+               request.pattern = std::move(path);
+
+               cd.requests[requestId] = std::move(request);
+            }
+            else if (const auto getterId = pathTrie.find(path); getterId >= 0) {
+               if (print_debug) {
+                  std::printf("[incppect] requestId = %d, path = '%s', nidxs = %d\n", requestId, path.c_str(), nidxs);
+               }
+               request.getterId = getterId;
+               request.priority = getters[getterId].options.priority;
+
+               cd.requests[requestId] = std::move(request);
+            }
+            else {
+               if (print_debug) {
+                  std::printf("[incppect] missing path '%s'\n", path.c_str());
+               }
+            }
+         }
+      } break;
+      case 2: {
+         const auto nRequests = (message.size() - sizeof(int32_t)) / sizeof(int32_t);
+         if (nRequests * sizeof(int32_t) + sizeof(int32_t) != message.size()) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid message data!\n");
+            }
+            return;
+         }
+         if (print_debug) {
+            std::printf("[incppect] received requests: %d\n", int(nRequests));
+         }
+
+         // full list of active requests - the ones that are no longer listed expire after the timeout
+         for (auto& [requestId, req] : cd.requests) {
+            req.isActive = false;
+         }
+         setActive(cd, message.substr(sizeof(int32_t)), true);
+      } break;
+      case 3: {
+         // keep the active requests alive
+         cd.tLastKeepalive_ms = timestamp();
+      } break;
+      case 4: {
+         // Custom event
+         doUpdate = false;
+         if (handler && message.size() > sizeof(int32_t)) {
+            handler(clientId, EventType::Custom, {message.data() + sizeof(int32_t), message.size() - sizeof(int32_t)});
+         }
+      } break;
+      case 5: {
+         // rpc call: [callId][nameLength][name, padded to 4 bytes][payload]
+         doUpdate = false;
+         if (message.size() < 3 * sizeof(uint32_t)) {
+            return;
+         }
+
+         uint32_t callId = 0;
+         uint32_t nameLength = 0;
+         std::memcpy(&callId, message.data() + 4, sizeof(callId));
+         std::memcpy(&nameLength, message.data() + 8, sizeof(nameLength));
+
+         const size_t payloadOffset = 12 + (size_t(nameLength) + 3) / 4 * 4;
+         if (payloadOffset > message.size()) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid rpc message!\n");
+            }
+            return;
+         }
+
+         call(clientId, callId, message.substr(12, nameLength), message.substr(payloadOffset));
+      } break;
+      case 7:
+      case 8: {
+         // incremental subscriptions: [ids of the requests to add (7) / remove (8)]
+         if ((message.size() - sizeof(int32_t)) % sizeof(int32_t) != 0) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid message data!\n");
+            }
+            return;
+         }
+
+         setActive(cd, message.substr(sizeof(int32_t)), type == 7);
+         cd.tLastKeepalive_ms = timestamp();
+      } break;
+      case 9: {
+         // update rates: [requestId][tMinUpdate_ms][tMaxUpdate_ms]...
+         doUpdate = false;
+         if ((message.size() - sizeof(int32_t)) % (3 * sizeof(int32_t)) != 0) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid message data!\n");
+            }
+            return;
+         }
+
+         for (size_t i = sizeof(int32_t); i < message.size(); i += 3 * sizeof(int32_t)) {
+            int32_t rate[3] = {};
+            std::memcpy(rate, message.data() + i, sizeof(rate));
+
+            const auto it = cd.requests.find(rate[0]);
+            if (it == cd.requests.end()) {
+               continue;
+            }
+
+            it->second.tMinUpdate_ms = rate[1] > 0 ? rate[1] : -1;
+            it->second.tMaxUpdate_ms = rate[2] > 0 ? rate[2] : -1;
+         }
+      } break;
+      case 14: {
+         // quantization: [requestId][mode][scale][offset]...
+         // the applied settings are echoed back before any frame that uses them
+         doUpdate = false;
+         if ((message.size() - sizeof(int32_t)) % (4 * sizeof(int32_t)) != 0) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid message data!\n");
+            }
+            return;
+         }
+
+         std::string reply;
+         const uint32_t typeAll = IncppectCodec::Quantization;
+         reply.append((const char*)(&typeAll), sizeof(typeAll));
+         for (size_t i = sizeof(int32_t); i < message.size(); i += 4 * sizeof(int32_t)) {
+            int32_t requestId = -1;
+            uint32_t mode = 0;
+            float scale = 0.0f;
+            float offset = 0.0f;
+            std::memcpy(&requestId, message.data() + i, sizeof(requestId));
+            std::memcpy(&mode, message.data() + i + 4, sizeof(mode));
+            std::memcpy(&scale, message.data() + i + 8, sizeof(scale));
+            std::memcpy(&offset, message.data() + i + 12, sizeof(offset));
+
+            const auto it = cd.requests.find(requestId);
+            if (it == cd.requests.end()) {
+               continue;
+            }
+
+            // only native float vars can be quantized
+            auto& req = it->second;
+            const auto& options = req.pattern.empty() ? getters[req.getterId].options : VarOptions{};
+            const bool isFloat = options.type == ElementType::Float32 || options.type == ElementType::Float64;
+            if (mode > IncppectCodec::Fixed || isFloat == false || options.endianness != kNativeEndianness ||
+                options.image.width > 0 || !(scale > 0.0f) || std::isfinite(offset) == false) {
+               mode = IncppectCodec::None;
+            }
+
+            req.quantization = mode;
+            req.quantizationScale = scale;
+            req.quantizationOffset = offset;
+            req.keyframe = true;
+
+            reply.append((const char*)(&requestId), sizeof(requestId));
+            reply.append((const char*)(&mode), sizeof(mode));
+            reply.append((const char*)(&scale), sizeof(scale));
+            reply.append((const char*)(&offset), sizeof(offset));
+         }
+
+         cd.send(reply, false);
+         txTotal_bytes += reply.size();
+      } break;
+      case 15: {
+         // filters: [requestId][op][a, float64][b, float64]...
+         doUpdate = false;
+         constexpr size_t kEntry_bytes = 2 * sizeof(int32_t) + 2 * sizeof(double);
+         if ((message.size() - sizeof(int32_t)) % kEntry_bytes != 0) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid message data!\n");
+            }
+            return;
+         }
+
+         for (size_t i = sizeof(int32_t); i < message.size(); i += kEntry_bytes) {
+            int32_t requestId = -1;
+            uint32_t op = 0;
+            std::memcpy(&requestId, message.data() + i, sizeof(requestId));
+            std::memcpy(&op, message.data() + i + 4, sizeof(op));
+
+            const auto it = cd.requests.find(requestId);
+            if (it == cd.requests.end() || op > IncppectCodec::Between) {
+               continue;
+            }
+
+            auto& req = it->second;
+            req.filter = op;
+            std::memcpy(&req.filterA, message.data() + i + 8, sizeof(req.filterA));
+            std::memcpy(&req.filterB, message.data() + i + 16, sizeof(req.filterB));
+            req.keyframe = true;
+            req.streamData.clear();
+            req.streamOffset = 0;
+         }
+      } break;
+      case 10: {
+         // frame ack: [seq][frame timestamp, 8 bytes][time the client held the ack, us]
+         doUpdate = false;
+         if (message.size() != 5 * sizeof(uint32_t)) {
+            if (print_debug) {
+               std::printf("[incppect] error : invalid message data!\n");
+            }
+            return;
+         }
+
+         uint32_t seq = 0;
+         int64_t tFrame_us = 0;
+         uint32_t tHold_us = 0;
+         std::memcpy(&seq, message.data() + 4, sizeof(seq));
+         std::memcpy(&tFrame_us, message.data() + 8, sizeof(tFrame_us));
+         std::memcpy(&tHold_us, message.data() + 16, sizeof(tHold_us));
+
+         // acks of frames that were not sent yet are ignored
+         if (int32_t(seq - cd.seqAcked) <= 0 || int32_t(cd.seq - seq) < 0) {
+            return;
+         }
+         cd.seqAcked = seq;
+         cd.nFramesInFlight = int32_t(cd.seq - cd.seqAcked);
+
+         const int32_t rtt_us = int32_t(std::clamp(timestamp_us() - tFrame_us - int64_t(tHold_us), int64_t(0),
+                                                   int64_t(std::numeric_limits<int32_t>::max())));
+         cd.rtt_us = cd.rtt_us < 0 ? rtt_us : int32_t((7 * int64_t(cd.rtt_us) + rtt_us) / 8);
+
+         const int32_t bucket = std::min(int32_t(std::bit_width(uint64_t(rtt_us) >> 7)), kRttBuckets - 1);
+         ++cd.rttHist[bucket];
+      } break;
+      case 12: {
+         // resume a session: [token, 8 bytes][seq of the last applied frame]
+         // new clients send a zero token to learn theirs
+         uint64_t token = 0;
+         uint32_t seqApplied = 0;
+         if (message.size() < sizeof(uint32_t) + sizeof(token) + sizeof(seqApplied)) {
+            return;
+         }
+         std::memcpy(&token, message.data() + 4, sizeof(token));
+         std::memcpy(&seqApplied, message.data() + 4 + sizeof(token), sizeof(seqApplied));
+
+         const bool isResumed = cd.requests.empty() && resumeSession(clientId, cd, token, seqApplied);
+         sendSession(cd, isResumed);
+      } break;
+      case 13: {
+         // writes to settable vars: [requestId][size][data, padded to 4 bytes]...
+         doUpdate = parameters.applyWritesOnLoop;
+         size_t offset = sizeof(int32_t);
+         while (offset + 2 * sizeof(uint32_t) <= message.size()) {
+            int32_t requestId = -1;
+            uint32_t size = 0;
+            std::memcpy(&requestId, message.data() + offset, sizeof(requestId));
+            std::memcpy(&size, message.data() + offset + sizeof(requestId), sizeof(size));
+            offset += sizeof(requestId) + sizeof(size);
+            if (size > message.size() - offset) {
+               break;
+            }
+
+            const auto data = message.substr(offset, size);
+            offset += (size_t(size) + 3) / 4 * 4;
+
+            const auto it = cd.requests.find(requestId);
+            if (it == cd.requests.end() || it->second.getterId < 0 || !getters[it->second.getterId].setter) {
+               if (print_debug) {
+                  std::printf("[incppect] client %d wrote to request %d that is not settable\n", clientId, requestId);
+               }
+               continue;
+            }
+
+            Write write{it->second.getterId, it->second.idxs, std::string(data)};
+            if (parameters.applyWritesOnLoop) {
+               applyWrite(write);
+            }
+            else if (writes.push(std::move(write)) == false) {
+               ++nWritesDropped;
+               if (print_debug) {
+                  std::printf("[incppect] warning: write queue is full, dropping writes\n");
+               }
+            }
+         }
+      } break;
+      case 11: {
+         // keyframe request - the client could not apply a delta and waits for a keyframe
+         if (print_debug) {
+            std::printf("[incppect] client %d requested a keyframe\n", clientId);
+         }
+         cd.keyframe = true;
+      } break;
+      case 6: {
+         // schema hash cached by the client - the schema is only sent if it differs
+         doUpdate = false;
+
+         uint64_t hash = 0;
+         if (message.size() >= sizeof(uint32_t) + sizeof(hash)) {
+            std::memcpy(&hash, message.data() + 4, sizeof(hash));
+         }
+
+         const auto& cur = getSchema();
+         if (std::memcmp(&hash, cur.data() + 4, sizeof(hash)) != 0) {
+            cd.send(cur, cur.size() > 64);
+            txTotal_bytes += cur.size();
+         }
+      } break;
+      default:
+            if (print_debug) {
+               std::printf("[incppect] unknown message type: %d\n", type);
+            }
+      };
+
+      if (doUpdate && parameters.updateOnRequest) {
+         mainLoop->defer([this]() { update(); });
+      }
+   }
+
+   void update()
+   {
+      constexpr uint32_t kPadding = 4;
+
+      // frames are never allowed to grow past the payload limit of the websocket
+      const uint32_t maxFrame_bytes = uint32_t(std::max(parameters.maxPayloadLength_bytes, 1024));
+      const uint32_t maxChunk_bytes =
+         uint32_t(std::clamp(parameters.maxChunkSize_bytes, int32_t(kPadding), int32_t(maxFrame_bytes / 2))) /
+         kPadding * kPadding;
+
+      ++nTicks;
+
+      applyInvalidations();
+
+      if (timestamp() - tLastPrune_ms > parameters.tLastRequestTimeout_ms) {
+         pruneAsyncResults();
+         pruneDerived();
+         pruneExpansions();
+         tLastPrune_ms = timestamp();
+      }
+
+      for (auto& [clientId, cd] : clientData) {
+         if (const auto bufferedAmount = cd.getBufferedAmount(); bufferedAmount > 0) {
+            std::printf(
+               "[incppect] warning: buffered amount = %d, not sending updates to client %d. waiting for buffer to "
+               "drain\n",
+               bufferedAmount, clientId);
+            continue;
+         }
+
+         auto& curBuffer = cd.curBuffer;
+         auto& prevBuffer = cd.prevBuffer;
+         auto& diffBuffer = cd.diffBuffer;
+
+         // the header is filled in when the frame is sent
+         curBuffer.assign(kFrameHeader_bytes, 0);
+
+         const auto tCur = timestamp();
+
+         // refill the bandwidth budget - at most one second worth of credit is accumulated
+         const int64_t txBudget_bytes_per_s =
+            cd.txBudget_bytes_per_s < 0 ? parameters.txBudget_bytes_per_s : cd.txBudget_bytes_per_s;
+         const bool hasBudget = txBudget_bytes_per_s > 0;
+         if (hasBudget) {
+            if (cd.tLastCredit_ms >= 0) {
+               cd.txCredit_bytes += 1e-3 * double(txBudget_bytes_per_s) * double(tCur - cd.tLastCredit_ms);
+            }
+            cd.txCredit_bytes = std::min(cd.txCredit_bytes, double(txBudget_bytes_per_s));
+         }
+         cd.tLastCredit_ms = tCur;
+
+         // keyframes reset the delta state of all requests, so the client can start over from them
+         const bool isKeyframe = cd.keyframe || (parameters.tKeyframeInterval_ms > 0 &&
+                                                 tCur - cd.tLastKeyframe_ms >= parameters.tKeyframeInterval_ms);
+         if (isKeyframe) {
+            for (auto& [requestId, req] : cd.requests) {
+               req.keyframe = true;
+               req.streamOffset = 0;
+               req.batchChanged = req.pattern.empty() == false;
+            }
+            cd.bundleLayout.clear();
+         }
+
+         for (auto& due : cd.dueRequests) {
+            due.clear();
+         }
+         for (auto& [requestId, req] : cd.requests) {
+            if (isRequested(cd, req, tCur) == false) {
+               continue;
+            }
+
+            // large vars that are being streamed send their next chunk every update
+            const int64_t tMinUpdate_ms = std::max(req.tMinUpdate_ms, parameters.tMinUpdate_ms);
+            if (req.streamData.empty() && tCur - req.tLastUpdated_ms <= tMinUpdate_ms) {
+               continue;
+            }
+
+            // requests that missed their deadline are not held back by the budget
+            const bool isOverdue =
+               req.tMaxUpdate_ms >= 0 && req.tLastUpdated_ms >= 0 && tCur - req.tLastUpdated_ms > req.tMaxUpdate_ms;
+            const auto priority = isOverdue ? Priority::High : req.priority;
+
+            cd.dueRequests[int(priority)].emplace_back(requestId, &req);
+         }
+
+         for (int p = int(Priority::High); p >= int(Priority::Low); --p) {
+            auto& due = cd.dueRequests[p];
+            auto& lastServedRequestId = cd.lastServedRequestId[p];
+
+            if (p != int(Priority::High)) {
+               // continue the round-robin after the last request served from this class
+               auto it = std::upper_bound(due.begin(), due.end(), lastServedRequestId,
+                                          [](int32_t id, const auto& r) { return id < r.first; });
+               std::rotate(due.begin(), it, due.end());
+            }
+
+            for (auto& [requestId, req] : due) {
+               // high priority requests ignore the budget, the rest are deferred once it is exhausted
+               if (hasBudget && p != int(Priority::High) && cd.txCredit_bytes <= 0.0) {
+                  break;
+               }
+
+               const auto nAppended_bytes = appendRequest(curBuffer, maxFrame_bytes, maxChunk_bytes, requestId, *req);
+               if (nAppended_bytes > 0 || req->isBundleDue) {
+                  cd.txCredit_bytes -= double(nAppended_bytes);
+                  lastServedRequestId = requestId;
+               }
+            }
+         }
+
+         cd.txCredit_bytes -= double(appendBundle(cd, curBuffer, maxFrame_bytes, tCur));
+
+         if (curBuffer.size() > kFrameHeader_bytes) {
+            const uint32_t seq = ++cd.seq;
+            const int64_t tFrame_us = timestamp_us();
+            cd.nFramesInFlight = int32_t(cd.seq - cd.seqAcked);
+
+            uint32_t typeAll = isKeyframe ? 4 : 0;
+            std::memcpy(curBuffer.data(), &typeAll, sizeof(typeAll));
+            std::memcpy(curBuffer.data() + 4, &seq, sizeof(seq));
+            std::memcpy(curBuffer.data() + 8, &tFrame_us, sizeof(tFrame_us));
+
+            if (isKeyframe) {
+               cd.keyframe = false;
+               cd.tLastKeyframe_ms = tCur;
+            }
+
+            // the diff covers the records only and references the frame it is based on:
+            //
+            //   [typeAll = 1][seq][timestamp, 8 bytes][base seq][xor-rle of the records]
+            //
+            bool sendDiff = false;
+            if (isKeyframe == false && curBuffer.size() == prevBuffer.size() && curBuffer.size() > 256) {
+               const uint32_t baseSeq = seq - 1;
+               diffBuffer.assign(curBuffer, 0, kFrameHeader_bytes);
+               diffBuffer.append((const char*)(&baseSeq), sizeof(baseSeq));
+
+               typeAll = 1;
+               std::memcpy(diffBuffer.data(), &typeAll, sizeof(typeAll));
+               IncppectCodec::encodeXorRle(diffBuffer, prevBuffer.data() + kFrameHeader_bytes,
+                                           curBuffer.data() + kFrameHeader_bytes,
+                                           curBuffer.size() - kFrameHeader_bytes);
+
+               sendDiff = diffBuffer.size() < curBuffer.size();
+            }
+
+            const auto& frame = sendDiff ? diffBuffer : curBuffer;
+
+            // compress only for message larger than 64 bytes
+            const bool doCompress = frame.size() > 64;
+
+            if (cd.send(frame, doCompress) == false) {
+               std::printf("[incpeect] warning: backpressure for client %d increased \n", clientId);
+            }
+
+            txTotal_bytes += frame.size();
+
+            prevBuffer = curBuffer;
+         }
+      }
+
+      limitDeltaState();
+   }
+
+   // memory held for a request to encode its deltas, as far as evictDeltaState() can free it
+   // the last sent data of bundled requests makes up the bundle and streamed requests need it until the stream is done
+   static int64_t deltaState(const Request& req)
+   {
+      const bool hasBase = req.isBundled == false && req.streamData.empty();
+      return int64_t((hasBase ? req.prevData.capacity() + req.diffData.capacity() : 0) + req.batchData.capacity() +
+                     req.quantData.capacity() + req.sparseIdxs.capacity() * sizeof(uint32_t) +
+                     req.sparseValues.capacity() * sizeof(double));
+   }
+
+   // drop the delta state of a request - the next update of the request is sent in full
+   // returns the number of freed bytes
+   static int64_t evictDeltaState(Request& req)
+   {
+      const int64_t freed_bytes = deltaState(req);
+      if (freed_bytes == 0) {
+         return 0;
+      }
+
+      if (req.isBundled == false && req.streamData.empty()) {
+         std::string().swap(req.prevData);
+         std::string().swap(req.diffData);
+      }
+      std::string().swap(req.batchData);
+      std::string().swap(req.quantData);
+      std::vector<uint32_t>().swap(req.sparseIdxs);
+      std::vector<double>().swap(req.sparseValues);
+      req.curData = {};
+      req.keyframe = true;
+
+      return freed_bytes;
+   }
+
+   // enforce the per-client and the global limits of the delta state, least recently updated requests first
+   // once a limit is exceeded, the state is evicted down to 3/4 of it and the evicted requests keep no state for
+   // Parameters::tDeltaCooldown_ms, so that they are not evicted again on every update
+   void limitDeltaState()
+   {
+      const int64_t maxClient_bytes = parameters.maxDeltaStatePerClient_bytes;
+      const int64_t maxTotal_bytes = parameters.maxDeltaStateTotal_bytes;
+      const auto tCur = timestamp();
+
+      deltaStateTotal_bytes = 0;
+      for (auto& [clientId, cd] : clientData) {
+         cd.deltaState_bytes = 0;
+         for (auto& [requestId, req] : cd.requests) {
+            if (tCur < req.tDeltaCooldownEnd_ms) {
+               evictDeltaState(req);
+            }
+            cd.deltaState_bytes += deltaState(req);
+         }
+
+         if (maxClient_bytes > 0 && cd.deltaState_bytes > maxClient_bytes) {
+            evictionCandidates.clear();
+            for (auto& [requestId, req] : cd.requests) {
+               evictionCandidates.emplace_back(req.tLastUpdated_ms, &req, &cd);
+            }
+            evict(cd.deltaState_bytes - maxClient_bytes / 4 * 3, tCur);
+         }
+
+         deltaStateTotal_bytes += cd.deltaState_bytes;
+      }
+
+      // the sessions of disconnected clients go first, oldest first
+      for (const auto& [token, session] : sessions) {
+         deltaStateTotal_bytes += session.cd.deltaState_bytes;
+      }
+      while (maxTotal_bytes > 0 && deltaStateTotal_bytes > maxTotal_bytes && sessions.empty() == false) {
+         const auto it = std::min_element(sessions.begin(), sessions.end(), [](const auto& a, const auto& b) {
+            return a.second.tClosed_ms < b.second.tClosed_ms;
+         });
+         deltaStateTotal_bytes -= it->second.cd.deltaState_bytes;
+         sessions.erase(it);
+      }
+
+      if (maxTotal_bytes > 0 && deltaStateTotal_bytes > maxTotal_bytes) {
+         evictionCandidates.clear();
+         for (auto& [clientId, cd] : clientData) {
+            for (auto& [requestId, req] : cd.requests) {
+               evictionCandidates.emplace_back(req.tLastUpdated_ms, &req, &cd);
+            }
+         }
+         deltaStateTotal_bytes -= evict(deltaStateTotal_bytes - maxTotal_bytes / 4 * 3, tCur);
+      }
+   }
+
+   // evict the delta state of the candidates, oldest first, until at least `excess_bytes` are freed
+   // returns the number of freed bytes
+   int64_t evict(int64_t excess_bytes, int64_t tCur)
+   {
+      std::sort(evictionCandidates.begin(), evictionCandidates.end(),
+                [](const auto& a, const auto& b) { return std::get<0>(a) < std::get<0>(b); });
+
+      int64_t freed_bytes = 0;
+      for (auto& [tLastUpdated_ms, req, cd] : evictionCandidates) {
+         if (freed_bytes >= excess_bytes) {
+            break;
+         }
+
+         const auto n = evictDeltaState(*req);
+         if (n > 0) {
+            req->tDeltaCooldownEnd_ms = tCur + parameters.tDeltaCooldown_ms;
+            cd->deltaState_bytes -= n;
+            freed_bytes += n;
+            ++nDeltaEvictions;
+         }
+      }
+
+      return freed_bytes;
+   }
+
+   // append the record of a due request to the frame
+   // returns the number of appended bytes - 0 if there was no room left in the frame
+   uint32_t appendRequest(std::string& curBuffer, uint32_t maxFrame_bytes, uint32_t maxChunk_bytes,
+                          int32_t requestId, Request& req)
+   {
+      constexpr uint32_t kPadding = 4;
+      constexpr uint32_t kRecordHeader_bytes = 3 * sizeof(int32_t);
+
+      const auto size0 = curBuffer.size();
+      const auto tCur = timestamp();
+
+      if (req.streamData.empty() == false) {
+         if (appendChunk(curBuffer, maxFrame_bytes, maxChunk_bytes, requestId, req) &&
+             req.streamOffset == req.streamData.size()) {
+            req.streamData.clear();
+            req.streamOffset = 0;
+            req.tLastUpdated_ms = tCur;
+            req.keyframe = false;
+         }
+         return uint32_t(curBuffer.size() - size0);
+      }
+
+      if (evaluate(req) == false) {
+         // async result not available yet
+         return 0;
+      }
+
+      if (req.quantization != IncppectCodec::None) {
+         IncppectCodec::quantize(req.quantData, req.curData.data(), req.curData.size(),
+                                 getters[req.getterId].options.type == ElementType::Float64, req.quantization,
+                                 req.quantizationScale, req.quantizationOffset);
+         req.curData = req.quantData;
+      }
+
+      req.isBundled = parameters.maxBundledSize_bytes > 0 && req.pattern.empty() &&
+                      req.filter == IncppectCodec::NoFilter &&
+                      req.curData.size() <= size_t(parameters.maxBundledSize_bytes);
+      if (req.isBundled) {
+         // sent with the bundle at the end of the update
+         if (req.tLastRequestTimeout_ms < 0) {
+            req.tLastRequested_ms = 0; // resetting last requested time
+         }
+         req.tLastUpdated_ms = tCur;
+         req.keyframe = false;
+         req.isBundleDue = true;
+
+         req.prevData.assign(req.curData.begin(), req.curData.end());
+         req.prevData.resize((req.curData.size() + kPadding - 1) / kPadding * kPadding, 0);
+
+         return 0;
+      }
+
+      if (req.batchChanged) {
+         // the layout of a batch is sent before its data whenever it changes:
+         //
+         //   [requestId][type = 4][size][count][pathLength][path, padded to 4 bytes]...
+         //
+         const auto layout0 = curBuffer.size();
+
+         const int32_t type = 4;
+         const uint32_t count = uint32_t(req.batch.size());
+         curBuffer.append((char*)(&requestId), sizeof(requestId));
+         curBuffer.append((char*)(&type), sizeof(type));
+         curBuffer.append(sizeof(uint32_t), 0);
+         curBuffer.append((char*)(&count), sizeof(count));
+         for (const auto& match : req.batch) {
+            const uint32_t pathLength = uint32_t(match.path.size());
+            curBuffer.append((char*)(&pathLength), sizeof(pathLength));
+            curBuffer.append(match.path);
+            curBuffer.append((kPadding - pathLength % kPadding) % kPadding, 0);
+         }
+
+         const uint32_t size_bytes = uint32_t(curBuffer.size() - layout0 - kRecordHeader_bytes);
+         if (layout0 > kFrameHeader_bytes && curBuffer.size() > maxFrame_bytes) {
+            curBuffer.resize(layout0);
+            return 0;
+         }
+         std::memcpy(curBuffer.data() + layout0 + 2 * sizeof(int32_t), &size_bytes, sizeof(size_bytes));
+
+         req.batchChanged = false;
+      }
+
+      if (req.filter != IncppectCodec::NoFilter) {
+         return appendSparse(curBuffer, maxFrame_bytes, maxChunk_bytes, requestId, req);
+      }
+
+      const uint32_t dataSize_bytes = uint32_t(req.curData.size());
+      const uint32_t padding_bytes = (kPadding - dataSize_bytes % kPadding) % kPadding;
+      const uint32_t paddedSize_bytes = dataSize_bytes + padding_bytes;
+
+      int32_t type = 0; // full update
+      if (req.keyframe == false && req.prevData.size() == paddedSize_bytes && req.pattern.empty()) {
+         const auto& image = getters[req.getterId].options.image;
+         const IncppectCodec::Image geometry = {
+            uint32_t(image.width), uint32_t(image.height), uint32_t(image.format), uint32_t(pixelSize(image.format)),
+            uint32_t(std::clamp(image.tileSize, 1, std::max(std::min(image.width, image.height), 1)))};
+         if (image.width > 0 && image.height > 0 && geometry.isValid() && geometry.size_bytes() == dataSize_bytes) {
+            // tiles that changed, as long as they are smaller than the image and fit in a chunk
+            req.diffData.clear();
+            if (IncppectCodec::encodeTiles(req.diffData, req.prevData.data(), req.curData.data(), geometry,
+                                           std::min(paddedSize_bytes - 1, maxChunk_bytes), tilePrev, tileCur)) {
+               type = IncppectCodec::Tiles;
+            }
+         }
+      }
+
+      if (type == 0 && paddedSize_bytes > maxChunk_bytes) {
+         // snapshot the data, since the getter result is only valid until the next call
+         req.streamData.assign(req.curData.begin(), req.curData.end());
+         req.streamData.resize(paddedSize_bytes, 0);
+         req.streamOffset = 0;
+
+         if (req.tLastRequestTimeout_ms < 0) {
+            req.tLastRequested_ms = 0; // resetting last requested time
+         }
+
+         appendChunk(curBuffer, maxFrame_bytes, maxChunk_bytes, requestId, req);
+         return uint32_t(curBuffer.size() - size0);
+      }
+
+      if (type == 0 && req.keyframe == false && req.prevData.size() == paddedSize_bytes && paddedSize_bytes > 256) {
+         req.diffData.clear();
+         IncppectCodec::encodeXorRle(req.diffData, req.prevData.data(), req.curData.data(), dataSize_bytes);
+         if (req.diffData.size() < paddedSize_bytes) {
+            type = 1; // run-length encoding of diff
+         }
+      }
+
+      const uint32_t payload_bytes = type == 0 ? paddedSize_bytes : uint32_t(req.diffData.size());
+      if (curBuffer.size() > kFrameHeader_bytes &&
+          curBuffer.size() + kRecordHeader_bytes + payload_bytes > maxFrame_bytes) {
+         // no room left in this frame - the request stays due and goes out with the next one
+         return uint32_t(curBuffer.size() - size0);
+      }
+
+      if (req.tLastRequestTimeout_ms < 0) {
+         req.tLastRequested_ms = 0; // resetting last requested time
+      }
+      req.tLastUpdated_ms = tCur;
+      req.keyframe = false;
+
+      curBuffer.append((char*)(&requestId), sizeof(requestId));
+      curBuffer.append((char*)(&type), sizeof(type));
+      curBuffer.append((char*)(&payload_bytes), sizeof(payload_bytes));
+
+      if (type == 0) {
+         curBuffer.append(req.curData.begin(), req.curData.end());
+         curBuffer.append(padding_bytes, 0);
+      }
+      else {
+         curBuffer.append(req.diffData.begin(), req.diffData.end());
+      }
+
+      req.prevData.assign(req.curData.begin(), req.curData.end());
+      req.prevData.resize(paddedSize_bytes, 0);
+
+      return uint32_t(curBuffer.size() - size0);
+   }
+
+   // elements of a filtered request that pass the filter, as changes to the set sent last time:
+   //
+   //   [requestId][type = 8][size][flags][nRemoved][nSet][removed indices][set indices][set values, float64]
+   //
+   // the elements are the vars of a wildcard request (their first element) or the elements of a single var
+   // returns the number of appended bytes - nothing is appended if the set did not change
+   uint32_t appendSparse(std::string& curBuffer, uint32_t maxFrame_bytes, uint32_t maxChunk_bytes, int32_t requestId,
+                         Request& req)
+   {
+      constexpr uint32_t kRecordHeader_bytes = IncppectCodec::kRecordHeader_bytes;
+      constexpr uint32_t kSparseHeader_bytes = 3 * sizeof(uint32_t);
+
+      auto& idxs = filteredIdxs;
+      auto& values = filteredValues;
+      idxs.clear();
+      values.clear();
+
+      const auto check = [&](uint32_t index, double v) {
+         if (IncppectCodec::passes(req.filter, v, req.filterA, req.filterB)) {
+            idxs.push_back(index);
+            values.push_back(v);
+         }
+      };
+
+      if (req.pattern.empty()) {
+         const auto type = getters[req.getterId].options.type;
+         const size_t size = elementSize(type);
+         for (size_t i = 0; i + size <= req.curData.size(); i += size) {
+            check(uint32_t(i / size), element(type, req.curData.data() + i));
+         }
+      }
+      else {
+         size_t offset = 0;
+         for (uint32_t i = 0; i < req.batch.size() && offset + sizeof(uint32_t) <= req.curData.size(); ++i) {
+            uint32_t size = 0;
+            std::memcpy(&size, req.curData.data() + offset, sizeof(size));
+            const auto type = getters[req.batch[i].id].options.type;
+            if (size >= elementSize(type)) {
+               check(i, element(type, req.curData.data() + offset + sizeof(size)));
+            }
+            offset += sizeof(size) + (size_t(size) + 3) / 4 * 4;
+         }
+      }
+
+      // every element takes 12 bytes in the full set
+      uint32_t flags = 0;
+      const size_t maxElements = (maxChunk_bytes - std::min(maxChunk_bytes, kSparseHeader_bytes)) / 12;
+      if (idxs.size() > maxElements) {
+         idxs.resize(maxElements);
+         values.resize(maxElements);
+         flags |= IncppectCodec::SparseTruncated;
+      }
+
+      // changes against the previous set - both are sorted by index
+      sparseRemoved.clear();
+      sparseSet.clear();
+      if (req.keyframe == false) {
+         size_t j = 0;
+         for (size_t i = 0; i < idxs.size(); ++i) {
+            while (j < req.sparseIdxs.size() && req.sparseIdxs[j] < idxs[i]) {
+               sparseRemoved.push_back(req.sparseIdxs[j++]);
+            }
+            if (j < req.sparseIdxs.size() && req.sparseIdxs[j] == idxs[i]) {
+               if (std::memcmp(&req.sparseValues[j], &values[i], sizeof(double)) != 0) {
+                  sparseSet.push_back(uint32_t(i));
+               }
+               ++j;
+            }
+            else {
+               sparseSet.push_back(uint32_t(i));
+            }
+         }
+         while (j < req.sparseIdxs.size()) {
+            sparseRemoved.push_back(req.sparseIdxs[j++]);
+         }
+      }
+
+      const auto tCur = timestamp();
+      const bool isFull = req.keyframe || 4 * sparseRemoved.size() + 12 * sparseSet.size() >= 12 * idxs.size();
+      if (isFull == false && sparseRemoved.empty() && sparseSet.empty()) {
+         if (req.tLastRequestTimeout_ms < 0) {
+            req.tLastRequested_ms = 0; // resetting last requested time
+         }
+         req.tLastUpdated_ms = tCur;
+         return 0;
+      }
+
+      if (isFull) {
+         flags |= IncppectCodec::SparseFull;
+         sparseRemoved.clear();
+         sparseSet.resize(idxs.size());
+         for (size_t i = 0; i < idxs.size(); ++i) {
+            sparseSet[i] = uint32_t(i);
+         }
+      }
+
+      const uint32_t nRemoved = uint32_t(sparseRemoved.size());
+      const uint32_t nSet = uint32_t(sparseSet.size());
+      const uint32_t payload_bytes = kSparseHeader_bytes + 4 * nRemoved + 12 * nSet;
+      if (curBuffer.size() > kFrameHeader_bytes &&
+          curBuffer.size() + kRecordHeader_bytes + payload_bytes > maxFrame_bytes) {
+         // no room left in this frame - the request stays due and goes out with the next one
+         return 0;
+      }
+
+      const int32_t type = IncppectCodec::Sparse;
+      const auto size0 = curBuffer.size();
+      curBuffer.append((char*)(&requestId), sizeof(requestId));
+      curBuffer.append((char*)(&type), sizeof(type));
+      curBuffer.append((char*)(&payload_bytes), sizeof(payload_bytes));
+      curBuffer.append((char*)(&flags), sizeof(flags));
+      curBuffer.append((char*)(&nRemoved), sizeof(nRemoved));
+      curBuffer.append((char*)(&nSet), sizeof(nSet));
+      curBuffer.append((char*)(sparseRemoved.data()), 4 * nRemoved);
+      for (const auto i : sparseSet) {
+         curBuffer.append((char*)(&idxs[i]), sizeof(idxs[i]));
+      }
+      for (const auto i : sparseSet) {
+         curBuffer.append((char*)(&values[i]), sizeof(values[i]));
+      }
+
+      if (req.tLastRequestTimeout_ms < 0) {
+         req.tLastRequested_ms = 0; // resetting last requested time
+      }
+      req.tLastUpdated_ms = tCur;
+      req.keyframe = false;
+      req.sparseIdxs.assign(idxs.begin(), idxs.end());
+      req.sparseValues.assign(values.begin(), values.end());
+
+      return uint32_t(curBuffer.size() - size0);
+   }
+
+   // small vars of the client packed into a single record, after their layout whenever it changes:
+   //
+   //   [-1][type = 5][size][count][requestId, size]...
+   //   [-1][type = 6][size][data, padded to 4 bytes]...
+   //
+   // the bundle is sent when any of its vars was updated and carries the last value of the rest, so its layout
+   // stays the same from frame to frame and the frame diff takes care of the unchanged values
+   // returns the number of appended bytes
+   uint32_t appendBundle(ClientData& cd, std::string& curBuffer, uint32_t maxFrame_bytes, int64_t tCur)
+   {
+      constexpr int32_t kBundleId = -1;
+
+      bool isDue = false;
+      auto& layout = cd.bundleLayoutNew;
+      layout.clear();
+      for (auto& [requestId, req] : cd.requests) {
+         // one-shot requests are no longer requested once they were updated
+         if (req.isBundled == false || (req.isBundleDue == false && isRequested(cd, req, tCur) == false)) {
+            continue;
+         }
+
+         layout.push_back(uint32_t(requestId));
+         layout.push_back(uint32_t(req.prevData.size()));
+         isDue = isDue || req.isBundleDue;
+      }
+
+      if (isDue == false && layout == cd.bundleLayout) {
+         return 0;
+      }
+
+      const auto size0 = curBuffer.size();
+      const bool isLayoutChanged = layout != cd.bundleLayout;
+      if (isLayoutChanged) {
+         const int32_t type = IncppectCodec::BundleLayout;
+         const uint32_t count = uint32_t(layout.size() / 2);
+         const uint32_t size_bytes = uint32_t(sizeof(count) + layout.size() * sizeof(uint32_t));
+         curBuffer.append((const char*)(&kBundleId), sizeof(kBundleId));
+         curBuffer.append((const char*)(&type), sizeof(type));
+         curBuffer.append((const char*)(&size_bytes), sizeof(size_bytes));
+         curBuffer.append((const char*)(&count), sizeof(count));
+         curBuffer.append((const char*)(layout.data()), layout.size() * sizeof(uint32_t));
+      }
+
+      const int32_t type = IncppectCodec::Bundle;
+      const auto record0 = curBuffer.size();
+      curBuffer.append((const char*)(&kBundleId), sizeof(kBundleId));
+      curBuffer.append((const char*)(&type), sizeof(type));
+      curBuffer.append(sizeof(uint32_t), 0);
+      for (size_t i = 0; i < layout.size(); i += 2) {
+         const auto& req = cd.requests[int32_t(layout[i])];
+         curBuffer.append(req.prevData);
+      }
+
+      const uint32_t size_bytes = uint32_t(curBuffer.size() - record0 - IncppectCodec::kRecordHeader_bytes);
+      if (size0 > kFrameHeader_bytes && curBuffer.size() > maxFrame_bytes) {
+         // no room left in this frame - the bundle stays due and goes out with the next one
+         curBuffer.resize(size0);
+         return 0;
+      }
+      std::memcpy(curBuffer.data() + record0 + 2 * sizeof(int32_t), &size_bytes, sizeof(size_bytes));
+
+      for (auto& [requestId, req] : cd.requests) {
+         req.isBundleDue = false;
+      }
+      if (isLayoutChanged) {
+         cd.bundleLayout.swap(layout);
+      }
+
+      return uint32_t(curBuffer.size() - size0);
+   }
+
+   // the client asked for the request recently enough, or it is kept alive by the keepalives
+   static bool isRequested(const ClientData& cd, const Request& req, int64_t tCur)
+   {
+      const int64_t tLastRequested_ms =
+         req.isActive ? std::max(req.tLastRequested_ms, cd.tLastKeepalive_ms) : req.tLastRequested_ms;
+      return (req.tLastRequestTimeout_ms < 0 && tLastRequested_ms > 0) ||
+             (tCur - tLastRequested_ms < req.tLastRequestTimeout_ms);
+   }
+
+   // mark the requests with the given ids as active or inactive
+   // removed requests stop being sent right away, but keep their delta base
+   void setActive(ClientData& cd, std::string_view ids, bool isActive)
+   {
+      const auto tCur = timestamp();
+      for (size_t i = 0; i + sizeof(int32_t) <= ids.size(); i += sizeof(int32_t)) {
+         int32_t requestId = -1;
+         std::memcpy(&requestId, ids.data() + i, sizeof(requestId));
+
+         const auto it = cd.requests.find(requestId);
+         if (it == cd.requests.end()) {
+            continue;
+         }
+
+         auto& req = it->second;
+         req.isActive = isActive;
+         req.tLastRequested_ms = isActive ? tCur : -1;
+         req.tLastRequestTimeout_ms = parameters.tLastRequestTimeout_ms;
+      }
+   }
+
+   // evaluate the getter of a request into req.curData
+   // returns false if the getter is async and has no completed result yet
+   bool evaluate(Request& req)
+   {
+      if (req.pattern.empty()) {
+         return evaluate(req.getterId, req.idxs, req.curData);
+      }
+
+      // batches are sent as a sequence of [size][data, padded to 4 bytes] entries
+      // the indices of a request change when the client resumes its session under a new id
+      if (req.expansion == nullptr || req.expansion->idxs != req.idxs) {
+         req.expansion = getExpansion(req.pattern, req.idxs);
+         req.batchVersion = 0;
+      }
+      refreshExpansion(*req.expansion);
+      if (req.batchVersion != req.expansion->version) {
+         req.batch = req.expansion->matches;
+         req.batchVersion = req.expansion->version;
+         req.batchChanged = true;
+      }
+
+      req.batchData.clear();
+      for (const auto& match : req.batch) {
+         std::string_view data;
+         if (evaluate(match.id, match.idxs, data) == false) {
+            data = {};
+         }
+
+         const uint32_t size = uint32_t(data.size());
+         req.batchData.append((const char*)(&size), sizeof(size));
+         req.batchData.append(data.begin(), data.end());
+         req.batchData.append((4 - size % 4) % 4, 0);
+      }
+
+      req.curData = req.batchData;
+      return true;
+   }
+
+   // cached expansion of a pattern, shared by all requests with the same pattern and indices
+   std::shared_ptr<IncppectPathTrie::Expansion> getExpansion(const std::string& pattern, const std::vector<int>& idxs)
+   {
+      auto& expansion = expansions[{pattern, idxs}];
+      if (expansion == nullptr) {
+         expansion = std::make_shared<IncppectPathTrie::Expansion>();
+         expansion->pattern = pattern;
+         expansion->idxs = idxs;
+      }
+
+      return expansion;
+   }
+
+   // the extents are checked at most once per update
+   void refreshExpansion(IncppectPathTrie::Expansion& expansion)
+   {
+      if (expansion.tick != nTicks) {
+         pathTrie.refresh(expansion);
+         expansion.tick = nTicks;
+      }
+   }
+
+   // mark the inputs of the derived vars passed to invalidate() since the last update
+   void applyInvalidations()
+   {
+      bool isAll = false;
+      size_t n = 0;
+      {
+         std::lock_guard lock(invalidMutex);
+         isAll = isInvalidAll;
+         n = nInvalidations;
+         invalidations.swap(invalidationsApplied);
+         isInvalidAll = false;
+         nInvalidations = 0;
+      }
+
+      if (derived.empty()) {
+         return;
+      }
+
+      if (isAll) {
+         for (auto& d : derived) {
+            for (auto& [idxs, state] : d->states) {
+               state.isValid = false;
+            }
+         }
+         return;
+      }
+
+      if (n == 0) {
+         return;
+      }
+
+      if (isDerivedInputsStale) {
+         derivedInputs.clear();
+         for (auto& d : derived) {
+            for (auto& [idxs, state] : d->states) {
+               for (size_t i = 0; i < state.inputs.size(); ++i) {
+                  derivedInputs[{state.inputs[i].id, state.inputs[i].idxs}].emplace_back(&state, uint32_t(i));
+               }
+            }
+         }
+         isDerivedInputsStale = false;
+      }
+
+      for (size_t k = 0; k < n; ++k) {
+         IncppectPathTrie::parse(invalidationsApplied[k], invalidPattern, invalidKey.second);
+         invalidKey.first = pathTrie.find(invalidPattern);
+         if (invalidKey.first < 0) {
+            continue;
+         }
+
+         const auto it = derivedInputs.find(invalidKey);
+         if (it == derivedInputs.end()) {
+            continue;
+         }
+         for (const auto& [state, i] : it->second) {
+            if (state->isDirty[i] == 0) {
+               state->isDirty[i] = 1;
+               state->dirty.push_back(i);
+            }
+         }
+      }
+   }
+
+   // drop the cached results of the derived vars that no request evaluated for a while
+   void pruneDerived()
+   {
+      const auto tCur = timestamp();
+      for (auto& d : derived) {
+         const auto nErased = std::erase_if(d->states, [&](const auto& item) {
+            return tCur - item.second.tLastUsed_ms > parameters.tLastRequestTimeout_ms;
+         });
+         isDerivedInputsStale |= nErased > 0;
+      }
+   }
+
+   // drop the expansions that are no longer used by any request
+   void pruneExpansions()
+   {
+      std::erase_if(expansions, [](const auto& item) { return item.second.use_count() == 1; });
+   }
+
+   // evaluate a getter for the given indices
+   // returns false if the getter is async and has no completed result yet
+   bool evaluate(int32_t getterId, const std::vector<int>& idxs, std::string_view& data)
+   {
+      auto& getter = getters[getterId];
+
+      if (getter.options.async) {
+         std::lock_guard lock(asyncMutex);
+
+         auto& result = asyncResults[{getterId, idxs}];
+         result.tLastUsed_ms = timestamp();
+         if (result.hasReady) {
+            result.data.swap(result.ready);
+            result.hasData = true;
+            result.hasReady = false;
+         }
+
+         if (result.isPending == false) {
+            if (workers.isStarted() == false) {
+               workers.start(parameters.nWorkers);
+            }
+
+            // the pool rejects the task while it stops - the getter is retried on the next update
+            result.isPending = workers.submit([this, getterId, func = getter.getter, idxs]() {
+               std::string data(func(idxs));
+
+               std::lock_guard lock(asyncMutex);
+               auto& result = asyncResults[{getterId, idxs}];
+               result.ready = std::move(data);
+               result.hasReady = true;
+               result.isPending = false;
+            });
+         }
+
+         if (result.hasData == false) {
+            return false;
+         }
+
+         data = result.data;
+         return true;
+      }
+
+      const int64_t tBudget_us = getter.options.tBudget_us < 0 ? parameters.tGetterBudget_us : getter.options.tBudget_us;
+      if (tBudget_us <= 0) {
+         data = getter.getter(idxs);
+         return true;
+      }
+
+      const auto tStart = std::chrono::steady_clock::now();
+      data = getter.getter(idxs);
+      const auto tCall_us =
+         std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count();
+
+      if (tCall_us > tBudget_us) {
+         if (print_debug) {
+            std::printf("[incppect] getter '%s' took %d us - moving it to the worker threads\n",
+                        getter.path.c_str(), int(tCall_us));
+         }
+         getter.options.async = true;
+      }
+
+      return true;
+   }
+
+   // drop the async results that have not been used for a while
+   void pruneAsyncResults()
+   {
+      const auto tCur = timestamp();
+
+      std::lock_guard lock(asyncMutex);
+      std::erase_if(asyncResults, [&](const auto& item) {
+         const auto& result = item.second;
+         return result.isPending == false && tCur - result.tLastUsed_ms > parameters.tLastRequestTimeout_ms;
+      });
+   }
+
+   static size_t elementSize(ElementType type)
+   {
+      switch (type) {
+      case ElementType::Int8:
+      case ElementType::UInt8:
+      case ElementType::String:
+         return 1;
+      case ElementType::Int16:
+      case ElementType::UInt16:
+         return 2;
+      case ElementType::Int64:
+      case ElementType::UInt64:
+      case ElementType::Float64:
+         return 8;
+      default:
+         return 4;
+      }
+   }
+
+   template <class T>
+   static double load(const char* p)
+   {
+      T v;
+      std::memcpy(&v, p, sizeof(T));
+      return double(v);
+   }
+
+   static double element(ElementType type, const char* p)
+   {
+      switch (type) {
+      case ElementType::Int8:
+         return load<int8_t>(p);
+      case ElementType::UInt8:
+      case ElementType::String:
+         return load<uint8_t>(p);
+      case ElementType::Int16:
+         return load<int16_t>(p);
+      case ElementType::UInt16:
+         return load<uint16_t>(p);
+      case ElementType::Int32:
+         return load<int32_t>(p);
+      case ElementType::UInt32:
+         return load<uint32_t>(p);
+      case ElementType::Int64:
+         return load<int64_t>(p);
+      case ElementType::UInt64:
+         return load<uint64_t>(p);
+      case ElementType::Float64:
+         return load<double>(p);
+      default:
+         return load<float>(p);
+      }
+   }
+
+   // read the elements of an input of a derived var into `values`, starting at `offset`
+   // at most `count` elements are read if count >= 0. returns the number of elements of the input
+   size_t readInput(const IncppectPathTrie::Match& input, std::vector<double>& values, size_t offset,
+                    int64_t count = -1)
+   {
+      std::string_view data;
+      if (evaluate(input.id, input.idxs, data) == false) {
+         data = {};
+      }
+
+      const auto type = getters[input.id].options.type;
+      const size_t size = elementSize(type);
+      const size_t nTotal = data.size() / size;
+      const size_t n = count >= 0 ? std::min(nTotal, size_t(count)) : nTotal;
+      if (offset + n > values.size()) {
+         values.resize(offset + n);
+      }
+      for (size_t i = 0; i < n; ++i) {
+         values[offset + i] = element(type, data.data() + i * size);
+      }
+
+      return nTotal;
+   }
+
+   static int32_t histogramBin(const DeriveOptions& options, double v)
+   {
+      const double scale = options.hi > options.lo ? double(options.bins) / (options.hi - options.lo) : 0.0;
+      const double x = (v - options.lo) * scale;
+      return x > 0.0 ? int32_t(std::min(x, double(options.bins - 1))) : 0;
+   }
+
+   // add (sign = 1) or remove (sign = -1) a value from the running aggregates of a derived var
+   static void accumulate(DerivedState& state, const DeriveOptions& options, double v, int32_t sign)
+   {
+      if (std::isnan(v)) {
+         state.nNan += sign;
+      }
+      else if (options.reduction == Reduction::Histogram) {
+         state.bins[histogramBin(options, v)] += uint32_t(sign);
+      }
+      else if (std::isinf(v)) {
+         (v > 0.0 ? state.nPosInf : state.nNegInf) += sign;
+      }
+      else {
+         // Neumaier summation - the error of each addition is kept in sumError
+         const double x = double(sign) * v;
+         const double t = state.sum + x;
+         state.sumError += std::abs(state.sum) >= std::abs(x) ? (state.sum - t) + x : (x - t) + state.sum;
+         state.sum = t;
+      }
+   }
+
+   static double aggregateSum(const DerivedState& state)
+   {
+      if (state.nNan > 0 || (state.nPosInf > 0 && state.nNegInf > 0)) {
+         return std::numeric_limits<double>::quiet_NaN();
+      }
+      if (state.nPosInf > 0 || state.nNegInf > 0) {
+         return state.nPosInf > 0 ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity();
+      }
+      return state.sum + state.sumError;
+   }
+
+   std::string_view evaluateDerived(Derived& d, const std::vector<int>& idxs)
+   {
+      auto& state = d.states[idxs];
+      state.tLastUsed_ms = timestamp();
+      if (state.isValid && state.tick == nTicks) {
+         return state.result;
+      }
+
+      if (state.expansion == nullptr) {
+         state.expansion = getExpansion(d.source, idxs);
+      }
+      refreshExpansion(*state.expansion);
+
+      const auto& options = d.options;
+      const bool hasAggregates = options.reduction == Reduction::Sum || options.reduction == Reduction::Mean ||
+                                 options.reduction == Reduction::Histogram;
+      // the running aggregates are recomputed from all of the values every kDerivedRecomputeTicks, so that the
+      // rounding errors of the updates do not accumulate
+      bool isFull = state.isValid == false || options.incremental == false ||
+                    state.inputsVersion != state.expansion->version ||
+                    nTicks - state.tickRecomputed >= kDerivedRecomputeTicks;
+      if (isFull == false) {
+         // the re-read inputs are patched in place as long as they keep their number of elements
+         for (const auto i : state.dirty) {
+            const auto begin = state.offsets[i];
+            const auto end = state.offsets[i + 1];
+            if (hasAggregates) {
+               for (auto j = begin; j < end; ++j) {
+                  accumulate(state, options, state.values[j], -1);
+               }
+            }
+            if (readInput(state.inputs[i], state.values, begin, end - begin) != end - begin) {
+               isFull = true;
+               break;
+            }
+            if (hasAggregates) {
+               for (auto j = begin; j < end; ++j) {
+                  accumulate(state, options, state.values[j], 1);
+               }
+            }
+            state.isDirty[i] = 0;
+         }
+      }
+
+      if (isFull) {
+         if (state.inputsVersion != state.expansion->version) {
+            state.inputs = state.expansion->matches;
+            state.inputsVersion = state.expansion->version;
+            isDerivedInputsStale = true;
+         }
+         state.offsets.clear();
+         state.values.clear();
+         for (const auto& input : state.inputs) {
+            state.offsets.push_back(uint32_t(state.values.size()));
+            readInput(input, state.values, state.values.size());
+         }
+         state.offsets.push_back(uint32_t(state.values.size()));
+         state.isDirty.assign(state.inputs.size(), 0);
+
+         state.sum = 0.0;
+         state.sumError = 0.0;
+         state.nNan = 0;
+         state.nPosInf = 0;
+         state.nNegInf = 0;
+         state.tickRecomputed = nTicks;
+         state.bins.assign(options.reduction == Reduction::Histogram ? options.bins : 0, 0);
+         if (hasAggregates) {
+            for (const auto v : state.values) {
+               accumulate(state, options, v, 1);
+            }
+         }
+      }
+      state.dirty.clear();
+      state.isValid = true;
+      state.tick = nTicks;
+
+      const auto& values = state.values;
+      auto& result = state.result;
+      result.clear();
+      switch (options.reduction) {
+      case Reduction::Histogram: {
+         result.assign((const char*)(state.bins.data()), state.bins.size() * sizeof(uint32_t));
+      } break;
+      case Reduction::TopK: {
+         topK.resize(values.size());
+         for (size_t i = 0; i < values.size(); ++i) {
+            topK[i] = {std::isnan(values[i]) ? -std::numeric_limits<double>::infinity() : values[i], double(i)};
+         }
+         const size_t k = std::min(size_t(options.k), topK.size());
+         std::partial_sort(topK.begin(), topK.begin() + k, topK.end(),
+                           [](const auto& a, const auto& b) { return a.first > b.first; });
+         topK.resize(options.k, {std::numeric_limits<double>::quiet_NaN(), -1.0});
+         result.assign((const char*)(topK.data()), options.k * sizeof(topK[0]));
+      } break;
+      default: {
+         double res = 0.0;
+         if (options.reduction == Reduction::Count) {
+            res = double(values.size());
+         }
+         else if (options.reduction == Reduction::Min || options.reduction == Reduction::Max) {
+            res = values.empty() ? std::numeric_limits<double>::quiet_NaN()
+                  : options.reduction == Reduction::Min ? *std::min_element(values.begin(), values.end())
+                                                        : *std::max_element(values.begin(), values.end());
+         }
+         else {
+            res = aggregateSum(state);
+            if (options.reduction == Reduction::Mean) {
+               res = values.empty() ? std::numeric_limits<double>::quiet_NaN() : res / double(values.size());
+            }
+         }
+         result.assign((const char*)(&res), sizeof(res));
+      } break;
+      }
+
+      return result;
+   }
+
+   void applyWrite(const Write& write)
+   {
+      const auto& setter = getters[write.getterId].setter;
+      if (setter) {
+         setter(write.idxs, write.data);
+      }
+   }
+
+   // binary schema of the registered vars:
+   //
+   //   [typeAll = 3][hash, 8 bytes][count]
+   //   [pathLength][type, endianness, ndims, flags][dims, ndims x 4 bytes][path, padded to 4 bytes]...
+   //
+   // flags: bit 0 - settable
+   //
+   // the hash is the 64-bit FNV-1a of the var entries and lets reconnecting clients skip the resend
+   const std::string& getSchema()
+   {
+      if (schema.empty() == false) {
+         return schema;
+      }
+
+      std::string entries;
+      uint32_t count = 0;
+      for (int32_t getterId = 0; getterId < int32_t(getters.size()); ++getterId) {
+         const auto& getter = getters[getterId];
+         if (pathTrie.find(getter.path) != getterId) {
+            continue;
+         }
+
+         const uint32_t pathLength = uint32_t(getter.path.size());
+         const uint8_t flags = getter.setter ? 1 : 0;
+         const uint8_t info[4] = {uint8_t(getter.options.type), uint8_t(getter.options.endianness),
+                                  uint8_t(getter.options.shape.size()), flags};
+         entries.append((const char*)(&pathLength), sizeof(pathLength));
+         entries.append((const char*)(info), sizeof(info));
+         entries.append((const char*)(getter.options.shape.data()), getter.options.shape.size() * sizeof(int32_t));
+         entries.append(getter.path);
+         entries.append((4 - pathLength % 4) % 4, 0);
+         ++count;
+      }
+
+      uint64_t hash = 0xcbf29ce484222325ull;
+      for (const char c : entries) {
+         hash ^= uint8_t(c);
+         hash *= 0x100000001b3ull;
+      }
+
+      const uint32_t typeAll = 3;
+      schema.append((const char*)(&typeAll), sizeof(typeAll));
+      schema.append((const char*)(&hash), sizeof(hash));
+      schema.append((const char*)(&count), sizeof(count));
+      schema.append(entries);
+
+      return schema;
+   }
+
+   // run a remote procedure for a client and send back the response
+   // async handlers run on the worker threads and their response is sent from the service loop
+   void call(int32_t clientId, uint32_t callId, std::string_view name, std::string_view payload)
+   {
+      const auto it = rpcs.find(name);
+      if (it == rpcs.end()) {
+         if (print_debug) {
+            std::printf("[incppect] unknown rpc '%.*s'\n", int(name.size()), name.data());
+         }
+         sendRpcResponse(clientId, callId, RpcStatus::UnknownMethod, {});
+         return;
+      }
+
+      auto& rpc = it->second;
+      if (rpc.options.async) {
+         if (workers.isStarted() == false) {
+            workers.start(parameters.nWorkers);
+         }
+
+         const bool isSubmitted =
+            workers.submit([this, clientId, callId, handler = rpc.handler, payload = std::string(payload)]() {
+               auto [status, response] = invoke(handler, clientId, payload);
+
+               // the response is dropped if the service stopped in the meantime
+               deferToLoop([this, clientId, callId, status, response = std::move(response)]() {
+                  sendRpcResponse(clientId, callId, status, response);
+               });
+            });
+
+         // the pool rejects the task while it stops - the handler runs on the loop instead
+         if (isSubmitted) {
+            return;
+         }
+      }
+
+      const auto tStart = std::chrono::steady_clock::now();
+      auto [status, response] = invoke(rpc.handler, clientId, payload);
+      const auto tCall_us =
+         std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count();
+
+      if (parameters.tRpcSlow_us > 0 && tCall_us > parameters.tRpcSlow_us) {
+         if (print_debug) {
+            std::printf("[incppect] rpc '%.*s' took %d us - moving it to the worker threads\n", int(name.size()),
+                        name.data(), int(tCall_us));
+         }
+         rpc.options.async = true;
+      }
+
+      sendRpcResponse(clientId, callId, status, response);
+   }
+
+   static std::pair<RpcStatus, std::string> invoke(const TRpcHandler& handler, int32_t clientId,
+                                                  std::string_view payload)
+   {
+      try {
+         return {RpcStatus::Ok, handler(clientId, payload)};
+      }
+      catch (const std::exception& e) {
+         return {RpcStatus::Error, e.what()};
+      }
+   }
+
+   // rpc responses are sent as separate messages:
+   //
+   //   [typeAll = 2][callId][status][payload]
+   //
+   void sendRpcResponse(int32_t clientId, uint32_t callId, RpcStatus status, std::string_view payload)
+   {
+      const auto it = clientData.find(clientId);
+      if (it == clientData.end()) {
+         return;
+      }
+
+      const uint32_t typeAll = 2;
+      std::string response;
+      response.reserve(3 * sizeof(uint32_t) + payload.size());
+      response.append((const char*)(&typeAll), sizeof(typeAll));
+      response.append((const char*)(&callId), sizeof(callId));
+      response.append((const char*)(&status), sizeof(status));
+      response.append(payload.begin(), payload.end());
+
+      it->second.send(response, response.size() > 64);
+
+      txTotal_bytes += response.size();
+   }
+
+   // append the next chunk of a streamed var to the frame
+   // chunk records carry the total size and the byte offset of the chunk in front of the payload:
+   //
+   //   [requestId][type = 2 (full) / 3 (xor-rle diff)][size][totalSize][offset][payload]
+   //
+   // returns false if there is no room left in the frame for the chunk
+   bool appendChunk(std::string& curBuffer, uint32_t maxFrame_bytes, uint32_t maxChunk_bytes, int32_t requestId,
+                    Request& req)
+   {
+      constexpr uint32_t kHeader_bytes = 5 * sizeof(uint32_t);
+      constexpr uint32_t kMinChunk_bytes = 1024;
+
+      const uint32_t total_bytes = uint32_t(req.streamData.size());
+      const uint32_t offset_bytes = req.streamOffset;
+
+      uint32_t chunk_bytes = std::min(maxChunk_bytes, total_bytes - offset_bytes);
+      if (curBuffer.size() + kHeader_bytes + chunk_bytes > maxFrame_bytes) {
+         if (curBuffer.size() + kHeader_bytes + kMinChunk_bytes > maxFrame_bytes) {
+            return false;
+         }
+         // use whatever is left in the frame
+         chunk_bytes = (maxFrame_bytes - uint32_t(curBuffer.size()) - kHeader_bytes) / 4 * 4;
+      }
+
+      const char* chunk = req.streamData.data() + offset_bytes;
+
+      // a var that changed size starts from a zeroed buffer on both ends
+      if (req.prevData.size() != total_bytes) {
+         req.prevData.assign(total_bytes, 0);
+      }
+
+      int32_t type = 2; // full chunk
+      req.diffData.clear();
+      if (req.keyframe == false) {
+         IncppectCodec::encodeXorRle(req.diffData, req.prevData.data() + offset_bytes, chunk, chunk_bytes);
+         if (req.diffData.size() < chunk_bytes) {
+            type = 3; // run-length encoding of the diff of the chunk
+         }
+      }
+
+      const uint32_t size_bytes = 2 * sizeof(uint32_t) + (type == 2 ? chunk_bytes : uint32_t(req.diffData.size()));
+
+      curBuffer.append((char*)(&requestId), sizeof(requestId));
+      curBuffer.append((char*)(&type), sizeof(type));
+      curBuffer.append((char*)(&size_bytes), sizeof(size_bytes));
+      curBuffer.append((char*)(&total_bytes), sizeof(total_bytes));
+      curBuffer.append((char*)(&offset_bytes), sizeof(offset_bytes));
+      if (type == 2) {
+         curBuffer.append(chunk, chunk_bytes);
+      }
+      else {
+         curBuffer.append(req.diffData.begin(), req.diffData.end());
+      }
+
+      std::memcpy(req.prevData.data() + offset_bytes, chunk, chunk_bytes);
+      req.streamOffset += chunk_bytes;
+
+      return true;
+   }
+
+   Parameters parameters;
+
+   double txTotal_bytes = 0.0;
+   double rxTotal_bytes = 0.0;
+
+   // derived vars, recomputed at most once per tick
+   static constexpr uint64_t kDerivedRecomputeTicks = 1024;
+   std::vector<std::unique_ptr<Derived>> derived{};
+   uint64_t nTicks = 0;
+   std::vector<std::pair<double, double>> topK{};
+   std::string invalidPattern{};
+   std::pair<int32_t, std::vector<int>> invalidKey{};
+
+   // (state, input index) of the inputs of the derived vars by (getterId, indices), used to look up the inputs
+   // passed to invalidate(). rebuilt when the inputs of a state change or states are dropped
+   std::map<std::pair<int32_t, std::vector<int>>, std::vector<std::pair<DerivedState*, uint32_t>>> derivedInputs{};
+   bool isDerivedInputsStale = false;
+
+   // paths passed to invalidate(), applied by the service loop
+   static constexpr size_t kMaxInvalidations = 4096;
+   std::mutex invalidMutex;
+   std::vector<std::string> invalidations{};
+   std::vector<std::string> invalidationsApplied{};
+   size_t nInvalidations = 0;
+   bool isInvalidAll = false;
+
+   // scratch buffers for the filtered requests
+   std::vector<uint32_t> filteredIdxs{};
+   std::vector<double> filteredValues{};
+   std::vector<uint32_t> sparseRemoved{};
+   std::vector<uint32_t> sparseSet{};
+
+   // scratch buffers for the tiles of image vars
+   std::string tilePrev{};
+   std::string tileCur{};
+
+   // writes of the clients, queued by the service loop and applied by applyWrites()
+   static constexpr size_t kWriteQueueSize = 4096;
+   IncppectSpscQueue<Write> writes{kWriteQueueSize};
+   Write pendingWrite{};
+   uint64_t nWritesDropped = 0;
+
+   // sessions of disconnected clients, by token
+   std::unordered_map<uint64_t, Session> sessions{};
+   std::random_device sessionRng{};
+
+   // memory accounting
+   int64_t deltaStateTotal_bytes = 0;
+   uint64_t nDeltaEvictions = 0;
+   uint64_t nRequestsRejected = 0;
+   std::vector<std::tuple<int64_t, Request*, ClientData*>> evictionCandidates{};
+
+   IncppectPathTrie pathTrie;
+   std::map<std::pair<std::string, std::vector<int>>, std::shared_ptr<IncppectPathTrie::Expansion>> expansions;
+   std::string schema; // cached, rebuilt after new vars are registered
+   std::vector<GetterData> getters;
+
+   // the loop is handed tasks from other threads, see deferToLoop()
+   std::mutex loopMutex;
+   uWS::Loop* mainLoop = nullptr;
+   us_listen_socket_t* listenSocket = nullptr;
+
+   // lifecycle of the service thread, see start() and shutdown()
+   // isServing, isStarting and pendingParameters are guarded by loopMutex
+   std::thread serviceThread;
+   std::atomic<bool> running = false;
+   bool isServing = false;
+   bool isStarting = false;
+   std::condition_variable startedCv;
+   std::optional<Parameters> pendingParameters{};
+   us_timer_t* drainTimer = nullptr;
+   int64_t tDrainEnd_ms = 0;
+   std::map<int, PerSocketData*> socketData;
+   std::map<int, ClientData> clientData;
+   std::atomic<int32_t> lastClientId = 1; // shared by all transports
+
+   // local transports
+   IncppectLocalServer localServer;
+   IncppectShmWriter shmWriter;
+   us_timer_t* shmTimer = nullptr;
+   std::string shmPattern;
+   std::vector<int> shmIdxs;
+   std::vector<std::string> shmVars; // Parameters::shmVars of shmExpansions
+   std::vector<std::shared_ptr<IncppectPathTrie::Expansion>> shmExpansions;
+
+   std::map<std::string, std::string> resources;
+
+   std::map<std::string, RpcData, std::less<>> rpcs;
+
+   std::mutex asyncMutex;
+   std::map<std::pair<int32_t, std::vector<int>>, AsyncResult> asyncResults;
+   int64_t tLastPrune_ms = 0;
+
+   IncppectThreadPool workers;
 
    THandler handler{}; // handle input from the clients
 };
@@ -0,0 +1,372 @@
+/*! \file local_server.h
+ *  \brief Unix domain socket transport for clients running on the same host.
+ *  \author Georgi Gerganov
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Speaks the websocket protocol of incppect without the websocket: every message in both directions is prefixed with
+// its size as a 4-byte little-endian integer. There is no compression and no masking.
+//
+// The sockets are served by a dedicated thread. The callbacks are invoked on that thread, send() and close() can be
+// called from any thread. Connections that do not read their data fast enough are closed once their unsent data
+// exceeds maxBuffered_bytes.
+struct IncppectLocalServer
+{
+   struct Callbacks
+   {
+      std::function<int32_t()> onOpen{}; // returns the id of the new connection
+      std::function<void(int32_t id, std::string&& message)> onMessage{};
+      std::function<void(int32_t id)> onClose{};
+   };
+
+   IncppectLocalServer() = default;
+   IncppectLocalServer(const IncppectLocalServer&) = delete;
+   IncppectLocalServer& operator=(const IncppectLocalServer&) = delete;
+
+   ~IncppectLocalServer() { stop(); }
+
+   // listen on the socket file at `path` with permissions `mode` - an existing file is replaced
+   bool start(const std::string& path, Callbacks&& callbacks, uint32_t maxMessage_bytes, uint64_t maxBuffered_bytes,
+              uint32_t mode = 0600)
+   {
+#ifdef _WIN32
+      (void)path;
+      (void)callbacks;
+      (void)maxMessage_bytes;
+      (void)maxBuffered_bytes;
+      (void)mode;
+      return false;
+#else
+      if (isRunning) {
+         return false;
+      }
+
+      sockaddr_un addr{};
+      if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+         return false;
+      }
+      addr.sun_family = AF_UNIX;
+      std::memcpy(addr.sun_path, path.data(), path.size());
+
+      listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listenFd < 0) {
+         return false;
+      }
+
+      // the file is created under the umask - its mode is set before the socket accepts connections
+      ::unlink(path.c_str());
+      if (::bind(listenFd, (const sockaddr*)(&addr), sizeof(addr)) != 0 || ::chmod(path.c_str(), mode_t(mode)) != 0 ||
+          ::listen(listenFd, 16) != 0 || ::pipe(wakeFds) != 0) {
+         ::close(listenFd);
+         ::unlink(path.c_str());
+         listenFd = -1;
+         return false;
+      }
+      setNonBlocking(listenFd);
+      setNonBlocking(wakeFds[0]);
+      setNonBlocking(wakeFds[1]);
+
+      this->path = path;
+      this->callbacks = std::move(callbacks);
+      this->maxMessage_bytes = maxMessage_bytes;
+      this->maxBuffered_bytes = maxBuffered_bytes;
+
+      isRunning = true;
+      worker = std::thread([this]() { work(); });
+
+      return true;
+#endif
+   }
+
+   // close all connections and the listening socket
+   void stop()
+   {
+#ifndef _WIN32
+      if (isRunning == false) {
+         return;
+      }
+
+      isRunning = false;
+      wake();
+      if (worker.joinable()) {
+         worker.join();
+      }
+
+      for (auto& [id, connection] : connections) {
+         ::close(connection->fd);
+         if (callbacks.onClose) {
+            callbacks.onClose(id);
+         }
+      }
+      connections.clear();
+
+      ::close(listenFd);
+      ::close(wakeFds[0]);
+      ::close(wakeFds[1]);
+      ::unlink(path.c_str());
+      listenFd = -1;
+#endif
+   }
+
+   bool isStarted() const { return isRunning; }
+
+   // queue a message - written right away if the socket has room for it
+   // returns false and closes the connection if it cannot keep up
+   bool send(int32_t id, std::string_view message)
+   {
+#ifdef _WIN32
+      (void)id;
+      (void)message;
+      return false;
+#else
+      std::lock_guard lock(mutex);
+      const auto it = connections.find(id);
+      if (it == connections.end() || it->second->isClosing) {
+         return false;
+      }
+
+      auto& connection = *it->second;
+      const uint32_t size = uint32_t(message.size());
+      connection.outBuffer.append((const char*)(&size), sizeof(size));
+      connection.outBuffer.append(message.begin(), message.end());
+
+      if (flush(connection) == false || connection.outBuffer.size() > maxBuffered_bytes) {
+         connection.isClosing = true;
+      }
+      if (connection.outBuffer.empty() == false || connection.isClosing) {
+         wake();
+      }
+
+      return connection.isClosing == false;
+#endif
+   }
+
+   // bytes queued for a connection that the socket has not accepted yet
+   int32_t getBufferedAmount(int32_t id)
+   {
+      std::lock_guard lock(mutex);
+      const auto it = connections.find(id);
+      return it == connections.end() ? 0 : int32_t(it->second->outBuffer.size());
+   }
+
+   void close(int32_t id)
+   {
+      std::lock_guard lock(mutex);
+      if (const auto it = connections.find(id); it != connections.end()) {
+         it->second->isClosing = true;
+         wake();
+      }
+   }
+
+  private:
+   struct Connection
+   {
+      int fd = -1;
+      bool isClosing = false;
+      std::string inBuffer{};
+      std::string outBuffer{};
+   };
+
+#ifndef _WIN32
+   static void setNonBlocking(int fd) { ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK); }
+
+   void wake()
+   {
+      const char c = 0;
+      [[maybe_unused]] const auto n = ::write(wakeFds[1], &c, 1);
+   }
+
+   // write as much of the queued data as the socket accepts, false on error
+   static bool flush(Connection& connection)
+   {
+      size_t offset = 0;
+      while (offset < connection.outBuffer.size()) {
+         const auto n = ::send(connection.fd, connection.outBuffer.data() + offset, connection.outBuffer.size() - offset,
+                               MSG_NOSIGNAL);
+         if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+               break;
+            }
+            return false;
+         }
+         offset += size_t(n);
+      }
+      connection.outBuffer.erase(0, offset);
+
+      return true;
+   }
+
+   // read the available data and dispatch the complete messages, false if the connection is done
+   bool receive(int32_t id, Connection& connection)
+   {
+      char buf[64 * 1024];
+      while (true) {
+         const auto n = ::recv(connection.fd, buf, sizeof(buf), 0);
+         if (n == 0) {
+            return false;
+         }
+         if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+               break;
+            }
+            if (errno == EINTR) {
+               continue;
+            }
+            return false;
+         }
+         connection.inBuffer.append(buf, size_t(n));
+      }
+
+      size_t offset = 0;
+      while (connection.inBuffer.size() - offset >= sizeof(uint32_t)) {
+         uint32_t size = 0;
+         std::memcpy(&size, connection.inBuffer.data() + offset, sizeof(size));
+         if (size > maxMessage_bytes) {
+            return false;
+         }
+         if (connection.inBuffer.size() - offset - sizeof(size) < size) {
+            break;
+         }
+
+         callbacks.onMessage(id, connection.inBuffer.substr(offset + sizeof(size), size));
+         offset += sizeof(size) + size;
+      }
+      connection.inBuffer.erase(0, offset);
+
+      return true;
+   }
+
+   void work()
+   {
+      std::vector<pollfd> fds;
+      std::vector<int32_t> ids;
+
+      while (isRunning) {
+         fds.clear();
+         ids.clear();
+         fds.push_back({wakeFds[0], POLLIN, 0});
+         fds.push_back({listenFd, POLLIN, 0});
+         {
+            std::lock_guard lock(mutex);
+            for (auto it = connections.begin(); it != connections.end();) {
+               auto& connection = *it->second;
+               if (connection.isClosing) {
+                  ::close(connection.fd);
+                  const auto id = it->first;
+                  it = connections.erase(it);
+                  callbacks.onClose(id);
+                  continue;
+               }
+
+               const short events = POLLIN | (connection.outBuffer.empty() ? 0 : POLLOUT);
+               fds.push_back({connection.fd, events, 0});
+               ids.push_back(it->first);
+               ++it;
+            }
+         }
+
+         if (::poll(fds.data(), fds.size(), -1) < 0) {
+            continue;
+         }
+
+         if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (::read(wakeFds[0], buf, sizeof(buf)) > 0) {
+            }
+         }
+
+         if (fds[1].revents & POLLIN) {
+            while (true) {
+               const int fd = ::accept(listenFd, nullptr, nullptr);
+               if (fd < 0) {
+                  break;
+               }
+               setNonBlocking(fd);
+#ifdef SO_NOSIGPIPE
+               const int one = 1;
+               ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+               auto connection = std::make_shared<Connection>();
+               connection->fd = fd;
+
+               const int32_t id = callbacks.onOpen();
+               std::lock_guard lock(mutex);
+               connections.emplace(id, std::move(connection));
+            }
+         }
+
+         for (size_t i = 0; i < ids.size(); ++i) {
+            const auto revents = fds[i + 2].revents;
+            if (revents == 0) {
+               continue;
+            }
+
+            std::shared_ptr<Connection> connection;
+            {
+               std::lock_guard lock(mutex);
+               const auto it = connections.find(ids[i]);
+               if (it == connections.end()) {
+                  continue;
+               }
+               connection = it->second;
+            }
+
+            bool isOk = (revents & (POLLERR | POLLNVAL)) == 0;
+            if (isOk && (revents & (POLLIN | POLLHUP))) {
+               isOk = receive(ids[i], *connection);
+            }
+
+            std::lock_guard lock(mutex);
+            if (isOk && (revents & POLLOUT)) {
+               isOk = flush(*connection);
+            }
+            if (isOk == false) {
+               connection->isClosing = true;
+            }
+         }
+      }
+   }
+#endif
+
+   std::string path{};
+   Callbacks callbacks{};
+   uint32_t maxMessage_bytes = 0;
+   uint64_t maxBuffered_bytes = 0;
+
+   int listenFd = -1;
+   int wakeFds[2] = {-1, -1};
+
+   std::atomic<bool> isRunning = false;
+   std::thread worker;
+
+   std::mutex mutex;
+   std::map<int32_t, std::shared_ptr<Connection>> connections;
+};
@@ -0,0 +1,428 @@
+/*! \file path_trie.h
+ *  \brief Compiled var paths for allocation-free lookups and wildcard subscriptions.
+ *  \author Georgi Gerganov
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Var paths are split into field tokens ("state", "ball", "x") and index tokens ("[%d]") and stored in a trie.
+// Lookups of registered paths walk the trie without allocating.
+//
+// Patterns may contain wildcards:
+//
+//   state.ball[*].x - all elements of an array, requires an extent for "state.ball"
+//   state.*.x       - any field
+//   state.*         - everything under "state"
+//
+struct IncppectPathTrie
+{
+   // number of elements of an array, given the indices of the enclosing arrays
+   using TExtent = std::function<int32_t(const std::vector<int>& idxs)>;
+
+   struct Match
+   {
+      int32_t id = -1;
+      std::vector<int> idxs{};
+      std::string path{}; // concrete path, e.g. "state.ball[3].x"
+
+      bool operator==(const Match& other) const { return id == other.id && idxs == other.idxs; }
+   };
+
+   // cached expansion of a pattern, kept up to date by refresh()
+   struct Expansion
+   {
+      std::string pattern{};
+      std::vector<int> idxs{};
+      std::vector<Match> matches{};
+      uint64_t version = 0; // incremented whenever the matches change
+      uint64_t tick = 0;    // last refresh, managed by the owner of the cache
+
+      uint64_t generation = 0; // of the trie when the matches were built, 0 - never
+      std::vector<int32_t> extents{};
+      std::vector<int32_t> extentsNew{};
+      std::vector<int> curIdxs{};
+      std::vector<Match> matchesNew{};
+   };
+
+   struct Node
+   {
+      int32_t id = -1;
+      int32_t index = -1; // child for "[%d]"
+      TExtent extent{};
+      std::map<std::string, int32_t, std::less<>> fields{};
+   };
+
+   static bool isPattern(std::string_view path) { return path.find('*') != std::string_view::npos; }
+
+   // split the next token from the path
+   // index tokens are returned without the brackets
+   static bool nextToken(std::string_view& path, std::string_view& token, bool& isIndex)
+   {
+      if (path.empty()) {
+         return false;
+      }
+
+      if (path[0] == '.') {
+         path.remove_prefix(1);
+      }
+
+      if (path.empty() == false && path[0] == '[') {
+         const auto end = path.find(']');
+         if (end == std::string_view::npos) {
+            return false;
+         }
+         isIndex = true;
+         token = path.substr(1, end - 1);
+         path.remove_prefix(end + 1);
+         return true;
+      }
+
+      const auto end = path.find_first_of(".[");
+      isIndex = false;
+      token = path.substr(0, end);
+      path.remove_prefix(end == std::string_view::npos ? path.size() : end);
+
+      return token.empty() == false;
+   }
+
+   // split a concrete path into a path with "[%d]" indices and the values of the indices
+   // e.g. "state.ball[3].x" -> "state.ball[%d].x", {3}. wildcards are kept as they are
+   static void parse(std::string_view path, std::string& result, std::vector<int>& idxs)
+   {
+      result.clear();
+      idxs.clear();
+
+      while (path.empty() == false) {
+         const auto begin = path.find('[');
+         const auto end = begin == std::string_view::npos ? std::string_view::npos : path.find(']', begin);
+         if (end == std::string_view::npos) {
+            result += path;
+            return;
+         }
+
+         const auto token = path.substr(begin + 1, end - begin - 1);
+         int idx = 0;
+         const auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), idx);
+         if (ec == std::errc() && ptr == token.data() + token.size()) {
+            result += path.substr(0, begin);
+            result += "[%d]";
+            idxs.push_back(idx);
+         }
+         else {
+            result += path.substr(0, end + 1);
+         }
+
+         path.remove_prefix(end + 1);
+      }
+   }
+
+   void insert(std::string_view path, int32_t id)
+   {
+      const auto node = walkOrCreate(path);
+      if (node >= 0) {
+         nodes[node].id = id;
+         ++generation;
+      }
+   }
+
+   // set the extent of the array at `path` (e.g. "state.ball" for "state.ball[%d].x")
+   bool setExtent(std::string_view path, TExtent&& extent)
+   {
+      const auto node = walkOrCreate(path);
+      if (node < 0) {
+         return false;
+      }
+
+      nodes[node].extent = std::move(extent);
+      ++generation;
+      return true;
+   }
+
+   // id registered for a path with "%d" indices, -1 if missing
+   int32_t find(std::string_view path) const
+   {
+      const auto node = walk(path);
+      return node < 0 ? -1 : nodes[node].id;
+   }
+
+   // expand a pattern into the registered paths that it matches
+   // "[%d]" tokens in the pattern take their values from `idxs`
+   void expand(std::string_view pattern, const std::vector<int>& idxs, std::vector<Match>& matches) const
+   {
+      matches.clear();
+
+      Match cur;
+      expand(0, pattern, idxs, 0, cur, matches);
+   }
+
+   // bring a cached expansion up to date, returns true if its matches changed
+   // the matches are only rebuilt when vars or extents were registered since the last refresh or when the extents
+   // that the pattern depends on return different counts - otherwise the refresh does not allocate
+   bool refresh(Expansion& expansion) const
+   {
+      if (expansion.generation == generation) {
+         expansion.extentsNew.clear();
+         expansion.curIdxs.clear();
+         extents(0, expansion.pattern, expansion.idxs, 0, expansion.curIdxs, expansion.extentsNew);
+         if (expansion.extentsNew == expansion.extents) {
+            return false;
+         }
+         expansion.extents.swap(expansion.extentsNew);
+      }
+      else {
+         expansion.extents.clear();
+         expansion.curIdxs.clear();
+         extents(0, expansion.pattern, expansion.idxs, 0, expansion.curIdxs, expansion.extents);
+         expansion.generation = generation;
+      }
+
+      expand(expansion.pattern, expansion.idxs, expansion.matchesNew);
+      if (expansion.matchesNew == expansion.matches) {
+         return false;
+      }
+
+      expansion.matches.swap(expansion.matchesNew);
+      ++expansion.version;
+      return true;
+   }
+
+  private:
+   int32_t walk(std::string_view path) const
+   {
+      int32_t node = 0;
+
+      std::string_view token;
+      bool isIndex = false;
+      while (nextToken(path, token, isIndex)) {
+         if (isIndex) {
+            node = nodes[node].index;
+         }
+         else {
+            const auto it = nodes[node].fields.find(token);
+            node = it == nodes[node].fields.end() ? -1 : it->second;
+         }
+
+         if (node < 0) {
+            return -1;
+         }
+      }
+
+      return path.empty() ? node : -1;
+   }
+
+   int32_t walkOrCreate(std::string_view path)
+   {
+      int32_t node = 0;
+
+      std::string_view token;
+      bool isIndex = false;
+      while (nextToken(path, token, isIndex)) {
+         int32_t child = -1;
+         if (isIndex) {
+            child = nodes[node].index;
+         }
+         else if (const auto it = nodes[node].fields.find(token); it != nodes[node].fields.end()) {
+            child = it->second;
+         }
+
+         if (child < 0) {
+            child = int32_t(nodes.size());
+            nodes.emplace_back();
+            if (isIndex) {
+               nodes[node].index = child;
+            }
+            else {
+               nodes[node].fields.emplace(token, child);
+            }
+         }
+
+         node = child;
+      }
+
+      return path.empty() ? node : -1;
+   }
+
+   static void pushField(Match& cur, std::string_view name)
+   {
+      if (cur.path.empty() == false) {
+         cur.path += '.';
+      }
+      cur.path += name;
+   }
+
+   static void pushIndex(Match& cur, int idx)
+   {
+      cur.idxs.push_back(idx);
+      cur.path += '[';
+      cur.path += std::to_string(idx);
+      cur.path += ']';
+   }
+
+   // everything under a node
+   void collect(int32_t node, Match& cur, std::vector<Match>& matches, bool includeSelf = true) const
+   {
+      const auto& n = nodes[node];
+      if (includeSelf && n.id >= 0) {
+         matches.push_back({n.id, cur.idxs, cur.path});
+      }
+
+      const auto pathSize = cur.path.size();
+      for (const auto& [name, child] : n.fields) {
+         pushField(cur, name);
+         collect(child, cur, matches);
+         cur.path.resize(pathSize);
+      }
+
+      if (n.index >= 0 && n.extent) {
+         const auto count = n.extent(cur.idxs);
+         for (int32_t i = 0; i < count; ++i) {
+            pushIndex(cur, i);
+            collect(n.index, cur, matches);
+            cur.idxs.pop_back();
+            cur.path.resize(pathSize);
+         }
+      }
+   }
+
+   void expand(int32_t node, std::string_view pattern, const std::vector<int>& idxs, size_t iIdx, Match& cur,
+               std::vector<Match>& matches) const
+   {
+      std::string_view token;
+      bool isIndex = false;
+      if (nextToken(pattern, token, isIndex) == false) {
+         if (nodes[node].id >= 0) {
+            matches.push_back({nodes[node].id, cur.idxs, cur.path});
+         }
+         return;
+      }
+
+      const auto& n = nodes[node];
+      const auto pathSize = cur.path.size();
+
+      if (isIndex) {
+         if (n.index < 0) {
+            return;
+         }
+
+         if (token == "*") {
+            const auto count = n.extent ? n.extent(cur.idxs) : 0;
+            for (int32_t i = 0; i < count; ++i) {
+               pushIndex(cur, i);
+               expand(n.index, pattern, idxs, iIdx, cur, matches);
+               cur.idxs.pop_back();
+               cur.path.resize(pathSize);
+            }
+         }
+         else if (iIdx < idxs.size()) {
+            pushIndex(cur, idxs[iIdx]);
+            expand(n.index, pattern, idxs, iIdx + 1, cur, matches);
+            cur.idxs.pop_back();
+            cur.path.resize(pathSize);
+         }
+
+         return;
+      }
+
+      if (token == "*") {
+         if (pattern.empty()) {
+            // trailing wildcard - everything under this node
+            collect(node, cur, matches, false);
+            return;
+         }
+
+         for (const auto& [name, child] : n.fields) {
+            pushField(cur, name);
+            expand(child, pattern, idxs, iIdx, cur, matches);
+            cur.path.resize(pathSize);
+         }
+         return;
+      }
+
+      if (const auto it = n.fields.find(token); it != n.fields.end()) {
+         pushField(cur, token);
+         expand(it->second, pattern, idxs, iIdx, cur, matches);
+         cur.path.resize(pathSize);
+      }
+   }
+
+   // the counts of the extents that the expansion of a pattern depends on, in the order of the expansion
+   void extents(int32_t node, std::string_view pattern, const std::vector<int>& idxs, size_t iIdx,
+                std::vector<int>& cur, std::vector<int32_t>& counts) const
+   {
+      std::string_view token;
+      bool isIndex = false;
+      if (nextToken(pattern, token, isIndex) == false) {
+         return;
+      }
+
+      const auto& n = nodes[node];
+      if (isIndex) {
+         if (n.index < 0) {
+            return;
+         }
+
+         if (token == "*") {
+            const auto count = n.extent ? n.extent(cur) : 0;
+            counts.push_back(count);
+            for (int32_t i = 0; i < count; ++i) {
+               cur.push_back(i);
+               extents(n.index, pattern, idxs, iIdx, cur, counts);
+               cur.pop_back();
+            }
+         }
+         else if (iIdx < idxs.size()) {
+            cur.push_back(idxs[iIdx]);
+            extents(n.index, pattern, idxs, iIdx + 1, cur, counts);
+            cur.pop_back();
+         }
+
+         return;
+      }
+
+      if (token == "*") {
+         if (pattern.empty()) {
+            collectExtents(node, cur, counts);
+            return;
+         }
+
+         for (const auto& [name, child] : n.fields) {
+            extents(child, pattern, idxs, iIdx, cur, counts);
+         }
+         return;
+      }
+
+      if (const auto it = n.fields.find(token); it != n.fields.end()) {
+         extents(it->second, pattern, idxs, iIdx, cur, counts);
+      }
+   }
+
+   // the counts of the extents under a node, in the order of collect()
+   void collectExtents(int32_t node, std::vector<int>& cur, std::vector<int32_t>& counts) const
+   {
+      const auto& n = nodes[node];
+      for (const auto& [name, child] : n.fields) {
+         collectExtents(child, cur, counts);
+      }
+
+      if (n.index >= 0 && n.extent) {
+         const auto count = n.extent(cur);
+         counts.push_back(count);
+         for (int32_t i = 0; i < count; ++i) {
+            cur.push_back(i);
+            collectExtents(n.index, cur, counts);
+            cur.pop_back();
+         }
+      }
+   }
+
+   std::vector<Node> nodes = std::vector<Node>(1);
+   uint64_t generation = 1; // changes whenever a var or an extent is registered
+};
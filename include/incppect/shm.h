@@ -0,0 +1,280 @@
+/*! \file shm.h
+ *  \brief Shared memory snapshot of incppect vars for readers on the same host.
+ *  \author Georgi Gerganov
+ *
+ *  The header has no dependencies besides the standard library and POSIX, so readers can include it directly.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <string_view>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Layout of the region:
+//
+//   [IncppectShmHeader]
+//   [pathLength][dataSize][path, padded to 8 bytes][data, padded to 8 bytes]...
+//
+// The region is protected by a seqlock: the writer makes `seq` odd while it updates the region and even again when it
+// is done. Readers copy the region and retry if `seq` was odd or changed in the meantime.
+struct IncppectShmHeader
+{
+   static constexpr uint32_t kMagic = 0x50434e49; // "INCP"
+   static constexpr uint32_t kVersion = 1;
+
+   uint32_t magic = kMagic;
+   uint32_t version = kVersion;
+   uint64_t capacity_bytes = 0; // size of the region, including the header
+   std::atomic<uint64_t> seq = 0;
+   int64_t t_us = 0;            // time of the snapshot, steady clock of the writer
+   uint32_t count = 0;          // number of vars
+   uint32_t size_bytes = 0;     // bytes used after the header
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the seqlock must be lock-free to work across processes");
+
+struct IncppectShmWriter
+{
+   IncppectShmWriter() = default;
+   IncppectShmWriter(const IncppectShmWriter&) = delete;
+   IncppectShmWriter& operator=(const IncppectShmWriter&) = delete;
+
+   ~IncppectShmWriter() { close(); }
+
+   // create the shared memory object `name` (e.g. "/incppect") with room for `capacity_bytes` and permissions `mode`
+   bool open(const std::string& name, uint64_t capacity_bytes, uint32_t mode = 0600)
+   {
+#ifdef _WIN32
+      (void)name;
+      (void)capacity_bytes;
+      (void)mode;
+      return false;
+#else
+      close();
+
+      capacity_bytes = std::max<uint64_t>(capacity_bytes, sizeof(IncppectShmHeader));
+      const int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR, mode_t(mode));
+      if (fd < 0) {
+         return false;
+      }
+
+      // an object left behind by an earlier run keeps its mode, and a new one is created under the umask
+      if (::fchmod(fd, mode_t(mode)) != 0 || ::ftruncate(fd, off_t(capacity_bytes)) != 0) {
+         ::close(fd);
+         ::shm_unlink(name.c_str());
+         return false;
+      }
+
+      void* addr = ::mmap(nullptr, capacity_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (addr == MAP_FAILED) {
+         ::shm_unlink(name.c_str());
+         return false;
+      }
+
+      this->name = name;
+      region = (char*)(addr);
+      capacity = capacity_bytes;
+
+      auto header = new (region) IncppectShmHeader();
+      header->capacity_bytes = capacity;
+
+      return true;
+#endif
+   }
+
+   void close()
+   {
+#ifndef _WIN32
+      if (region == nullptr) {
+         return;
+      }
+
+      ::munmap(region, capacity);
+      ::shm_unlink(name.c_str());
+      region = nullptr;
+#endif
+   }
+
+   bool isOpen() const { return region != nullptr; }
+
+   // start a new snapshot - the readers retry until end() is called
+   void begin()
+   {
+      auto header = (IncppectShmHeader*)(region);
+      header->seq.store(header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      cursor = sizeof(IncppectShmHeader);
+      count = 0;
+   }
+
+   // returns false if the var does not fit in the region
+   bool add(std::string_view path, std::string_view data)
+   {
+      const uint64_t size = 2 * sizeof(uint32_t) + padded(path.size()) + padded(data.size());
+      if (cursor + size > capacity) {
+         return false;
+      }
+
+      const uint32_t sizes[2] = {uint32_t(path.size()), uint32_t(data.size())};
+      std::memcpy(region + cursor, sizes, sizeof(sizes));
+      std::memcpy(region + cursor + sizeof(sizes), path.data(), path.size());
+      std::memcpy(region + cursor + sizeof(sizes) + padded(path.size()), data.data(), data.size());
+
+      cursor += size;
+      ++count;
+
+      return true;
+   }
+
+   void end(int64_t t_us)
+   {
+      auto header = (IncppectShmHeader*)(region);
+      header->t_us = t_us;
+      header->count = count;
+      header->size_bytes = uint32_t(cursor - sizeof(IncppectShmHeader));
+
+      std::atomic_thread_fence(std::memory_order_release);
+      header->seq.store(header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   static uint64_t padded(uint64_t size) { return (size + 7) / 8 * 8; }
+
+  private:
+   std::string name{};
+   char* region = nullptr;
+   uint64_t capacity = 0;
+
+   uint64_t cursor = 0;
+   uint32_t count = 0;
+};
+
+struct IncppectShmReader
+{
+   IncppectShmReader() = default;
+   IncppectShmReader(const IncppectShmReader&) = delete;
+   IncppectShmReader& operator=(const IncppectShmReader&) = delete;
+
+   ~IncppectShmReader() { close(); }
+
+   bool open(const std::string& name)
+   {
+#ifdef _WIN32
+      (void)name;
+      return false;
+#else
+      close();
+
+      const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+      if (fd < 0) {
+         return false;
+      }
+
+      IncppectShmHeader header;
+      if (::pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != IncppectShmHeader::kMagic ||
+          header.version != IncppectShmHeader::kVersion) {
+         ::close(fd);
+         return false;
+      }
+
+      void* addr = ::mmap(nullptr, header.capacity_bytes, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (addr == MAP_FAILED) {
+         return false;
+      }
+
+      region = (const char*)(addr);
+      capacity = header.capacity_bytes;
+
+      return true;
+#endif
+   }
+
+   void close()
+   {
+#ifndef _WIN32
+      if (region != nullptr) {
+         ::munmap((void*)(region), capacity);
+         region = nullptr;
+      }
+#endif
+   }
+
+   bool isOpen() const { return region != nullptr; }
+
+   // sequence number of the current snapshot - changes whenever the writer publishes a new one
+   uint64_t seq() const { return ((const IncppectShmHeader*)(region))->seq.load(std::memory_order_acquire); }
+
+   // copy a consistent snapshot of the vars, keyed by their path
+   // returns false if the writer is gone or did not finish a snapshot within `nRetries` attempts
+   bool read(std::map<std::string, std::string>& vars, int64_t* t_us = nullptr, int32_t nRetries = 1000)
+   {
+      if (region == nullptr) {
+         return false;
+      }
+
+      const auto header = (const IncppectShmHeader*)(region);
+
+      IncppectShmHeader snapshot;
+      for (int32_t i = 0; i < nRetries; ++i) {
+         const uint64_t seq0 = header->seq.load(std::memory_order_acquire);
+         if (seq0 % 2 == 1) {
+            continue;
+         }
+
+         snapshot.t_us = header->t_us;
+         snapshot.count = header->count;
+         snapshot.size_bytes = std::min<uint32_t>(header->size_bytes, uint32_t(capacity - sizeof(IncppectShmHeader)));
+         data.resize(snapshot.size_bytes);
+         std::memcpy(data.data(), region + sizeof(IncppectShmHeader), snapshot.size_bytes);
+
+         std::atomic_thread_fence(std::memory_order_acquire);
+         if (header->seq.load(std::memory_order_relaxed) != seq0) {
+            continue;
+         }
+
+         vars.clear();
+         size_t offset = 0;
+         for (uint32_t k = 0; k < snapshot.count && offset + 2 * sizeof(uint32_t) <= data.size(); ++k) {
+            uint32_t sizes[2] = {};
+            std::memcpy(sizes, data.data() + offset, sizeof(sizes));
+
+            const auto pathOffset = offset + sizeof(sizes);
+            const auto dataOffset = pathOffset + IncppectShmWriter::padded(sizes[0]);
+            if (dataOffset + sizes[1] > data.size()) {
+               break;
+            }
+
+            vars[data.substr(pathOffset, sizes[0])] = data.substr(dataOffset, sizes[1]);
+            offset = dataOffset + IncppectShmWriter::padded(sizes[1]);
+         }
+
+         if (t_us) {
+            *t_us = snapshot.t_us;
+         }
+         return true;
+      }
+
+      return false;
+   }
+
+  private:
+   const char* region = nullptr;
+   uint64_t capacity = 0;
+
+   std::string data{};
+};
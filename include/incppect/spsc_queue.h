@@ -0,0 +1,67 @@
+/*! \file spsc_queue.h
+ *  \brief Bounded lock-free queue for handing items from one thread to another.
+ *  \author Georgi Gerganov
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Single producer, single consumer ring buffer. push() must only be called from one thread and pop() from one
+// (possibly different) thread. The capacity is rounded up to a power of two.
+template <class T>
+struct IncppectSpscQueue
+{
+   explicit IncppectSpscQueue(size_t capacity = 1024)
+   {
+      size_t n = 2;
+      while (n < capacity) {
+         n *= 2;
+      }
+      slots.resize(n);
+      mask = n - 1;
+   }
+
+   IncppectSpscQueue(const IncppectSpscQueue&) = delete;
+   IncppectSpscQueue& operator=(const IncppectSpscQueue&) = delete;
+
+   // returns false if the queue is full
+   bool push(T&& item)
+   {
+      const size_t t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) > mask) {
+         return false;
+      }
+
+      slots[t & mask] = std::move(item);
+      tail.store(t + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   // returns false if the queue is empty
+   bool pop(T& item)
+   {
+      const size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire)) {
+         return false;
+      }
+
+      item = std::move(slots[h & mask]);
+      head.store(h + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   size_t capacity() const { return slots.size(); }
+
+  private:
+   std::vector<T> slots;
+   size_t mask = 0;
+
+   alignas(64) std::atomic<size_t> head = 0; // next slot to pop, owned by the consumer
+   alignas(64) std::atomic<size_t> tail = 0; // next slot to push, owned by the producer
+};
@@ -0,0 +1,169 @@
+/*! \file thread_pool.h
+ *  \brief Work-stealing worker threads for running slow work off the service loop.
+ *  \author Georgi Gerganov
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Each worker owns a task queue. Tasks submitted from the outside are distributed round-robin over the queues,
+// tasks submitted from a worker go to its own queue. Workers pop from the back of their own queue and steal from
+// the front of the other queues when they run out of work.
+struct IncppectThreadPool
+{
+   using TTask = std::function<void()>;
+
+   IncppectThreadPool() = default;
+   IncppectThreadPool(const IncppectThreadPool&) = delete;
+   IncppectThreadPool& operator=(const IncppectThreadPool&) = delete;
+
+   ~IncppectThreadPool() { stop(); }
+
+   // start the worker threads. does nothing if they are already running
+   void start(int32_t nThreads)
+   {
+      std::lock_guard lock(mutex);
+      if (workers.empty() == false) {
+         return;
+      }
+
+      isRunning = true;
+      nThreads = std::max(nThreads, 1);
+      for (int32_t i = 0; i < nThreads; ++i) {
+         queues.emplace_back(std::make_unique<Queue>());
+      }
+      for (int32_t i = 0; i < nThreads; ++i) {
+         workers.emplace_back([this, i]() { work(i); });
+      }
+   }
+
+   // finish the queued tasks and join the worker threads
+   void stop()
+   {
+      {
+         std::lock_guard lock(mutex);
+         isRunning = false;
+      }
+      cv.notify_all();
+
+      for (auto& worker : workers) {
+         if (worker.joinable()) {
+            worker.join();
+         }
+      }
+
+      std::lock_guard lock(mutex);
+      workers.clear();
+      queues.clear();
+   }
+
+   bool isStarted() const { return workers.empty() == false; }
+
+   int32_t nThreads() const { return int32_t(workers.size()); }
+
+   // number of queued tasks that have not been picked up by a worker yet
+   int32_t nPending() const { return nTasks.load(); }
+
+   // queue a task for the workers
+   // returns false and drops the task if the pool is not running, e.g. while it stops. the workers of the pool
+   // can still submit while it stops - their tasks are finished before the workers are joined
+   bool submit(TTask&& task)
+   {
+      {
+         // the pool mutex keeps stop() from clearing the queues and the workers from missing the task
+         std::lock_guard lock(mutex);
+         const bool isWorker = workerId >= 0 && workerOwner == this;
+         if (queues.empty() || (isRunning == false && isWorker == false)) {
+            return false;
+         }
+
+         const auto n = queues.size();
+         const auto idx = isWorker ? size_t(workerId) : nextQueue.fetch_add(1) % n;
+         std::lock_guard lockQueue(queues[idx]->mutex);
+         queues[idx]->tasks.emplace_back(std::move(task));
+         ++nTasks;
+      }
+      cv.notify_one();
+
+      return true;
+   }
+
+  private:
+   struct Queue
+   {
+      std::mutex mutex;
+      std::deque<TTask> tasks;
+   };
+
+   // nTasks is updated together with the queues, so that it only counts the tasks that can still be popped
+   bool pop(int32_t id, TTask& task)
+   {
+      {
+         auto& own = *queues[id];
+         std::lock_guard lock(own.mutex);
+         if (own.tasks.empty() == false) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --nTasks;
+            return true;
+         }
+      }
+
+      const auto n = int32_t(queues.size());
+      for (int32_t i = 1; i < n; ++i) {
+         auto& other = *queues[(id + i) % n];
+         std::lock_guard lock(other.mutex);
+         if (other.tasks.empty() == false) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            --nTasks;
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   void work(int32_t id)
+   {
+      workerId = id;
+      workerOwner = this;
+
+      while (true) {
+         {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this]() { return isRunning == false || nTasks > 0; });
+            if (nTasks == 0) {
+               return;
+            }
+         }
+
+         // the task can be taken by another worker in the meantime - then wait again
+         TTask task;
+         if (pop(id, task)) {
+            task();
+         }
+      }
+   }
+
+   static inline thread_local int32_t workerId = -1;
+   static inline thread_local const IncppectThreadPool* workerOwner = nullptr;
+
+   bool isRunning = false;
+   std::atomic<int32_t> nTasks = 0;
+   std::atomic<size_t> nextQueue = 0;
+
+   std::mutex mutex;
+   std::condition_variable cv;
+   std::vector<std::unique_ptr<Queue>> queues;
+   std::vector<std::thread> workers;
+};
@@ -0,0 +1,274 @@
+/*! \file test-codec.cpp
+ *  \brief Round trips of the record encodings in IncppectCodec
+ *  \author Georgi Gerganov
+ */
+
+#include "incppect/codec.h"
+
+#include "test.h"
+
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937 g_rng(1234);
+
+static std::string randomBytes(size_t n) {
+    std::string res(n, 0);
+    for (auto & c : res) {
+        c = char(g_rng() % 256);
+    }
+    return res;
+}
+
+// the data of a var as the client stores it - in 4-byte words, zero-extended
+static std::vector<uint32_t> toWords(const std::string & data) {
+    std::vector<uint32_t> res((data.size() + 3)/4, 0);
+    memcpy(res.data(), data.data(), data.size());
+    return res;
+}
+
+static void testXorRle() {
+    for (size_t n : { 0, 1, 3, 4, 7, 64, 1001, 4096, }) {
+        auto prev = randomBytes(n);
+        auto cur = prev;
+
+        // a few changed bytes, a changed range and a range with a constant xor
+        if (n > 0) {
+            cur[g_rng() % n] ^= 0x5a;
+        }
+        if (n > 64) {
+            for (size_t i = 16; i < 48; ++i) {
+                cur[i] = char(g_rng() % 256);
+            }
+            for (size_t i = 0; i < 16; ++i) {
+                cur[n - 16 + i] ^= 0x11;
+            }
+        }
+
+        auto base = toWords(prev);
+        const auto expected = toWords(cur);
+
+        // `prev` must be readable up to the padded size
+        prev.resize(base.size()*4, 0);
+
+        std::string encoded;
+        IncppectCodec::encodeXorRle(encoded, prev.data(), cur.data(), n);
+        CHECK(encoded.size() % 8 == 0);
+
+        const auto nCovered = IncppectCodec::applyXorRle(encoded.data(), encoded.size()/8, base.data(), base.size());
+        CHECK(nCovered == base.size());
+        CHECK(base == expected);
+    }
+
+    // identical data is a single run of zeros
+    {
+        const auto data = randomBytes(400);
+        std::string encoded;
+        IncppectCodec::encodeXorRle(encoded, data.data(), data.data(), data.size());
+        CHECK(encoded.size() == 8);
+
+        auto words = toWords(data);
+        CHECK(IncppectCodec::applyXorRle(encoded.data(), 1, words.data(), words.size()) == 100);
+        CHECK(words == toWords(data));
+    }
+
+    // runs past the end of the destination are clipped and reported
+    {
+        const auto prev = randomBytes(64);
+        const auto cur = randomBytes(64);
+        std::string encoded;
+        IncppectCodec::encodeXorRle(encoded, prev.data(), cur.data(), prev.size());
+
+        auto words = toWords(prev);
+        const auto nCovered = IncppectCodec::applyXorRle(encoded.data(), encoded.size()/8, words.data(), 10);
+        CHECK(nCovered == 16);
+        CHECK(std::equal(words.begin(), words.begin() + 10, toWords(cur).begin()));
+        CHECK(std::equal(words.begin() + 10, words.end(), toWords(prev).begin() + 10));
+    }
+}
+
+static void testTiles() {
+    IncppectCodec::Image image;
+    image.width = 37;
+    image.height = 23;
+    image.pixelSize = 3;
+    image.tileSize = 8;
+    CHECK(image.isValid());
+    CHECK(image.nTilesX() == 5);
+    CHECK(image.nTilesY() == 3);
+
+    const auto prev = randomBytes(image.size_bytes());
+    auto cur = prev;
+
+    // a pixel in the first tile, a noisy block in the last (partial) tile and a row across the middle
+    cur[0] ^= 1;
+    for (size_t y = 20; y < 23; ++y) {
+        for (size_t x = 33; x < 37; ++x) {
+            cur[(y*image.width + x)*image.pixelSize] = char(g_rng() % 256);
+        }
+    }
+    for (size_t x = 0; x < image.width*image.pixelSize; ++x) {
+        cur[10*image.width*image.pixelSize + x] ^= 0x20;
+    }
+
+    std::string encoded;
+    std::string tilePrev;
+    std::string tileCur;
+    CHECK(IncppectCodec::encodeTiles(encoded, prev.data(), cur.data(), image, 1 << 20, tilePrev, tileCur));
+
+    uint32_t header[6] = {};
+    memcpy(header, encoded.data(), sizeof(header));
+    CHECK(header[5] == 1 + 1 + image.nTilesX()); // the changed row spans all the tiles of its tile row
+
+    std::vector<uint32_t> tile;
+    auto dst = prev;
+    CHECK(IncppectCodec::applyTiles(encoded.data(), encoded.size(), dst.data(), dst.size(), tile));
+    CHECK(dst == cur);
+
+    // no tiles for unchanged data
+    {
+        std::string unchanged;
+        CHECK(IncppectCodec::encodeTiles(unchanged, cur.data(), cur.data(), image, 1 << 20, tilePrev, tileCur));
+        CHECK(unchanged.size() == IncppectCodec::kTilesHeader_bytes);
+    }
+
+    // the budget is exceeded - nothing is appended
+    {
+        std::string limited = "abc";
+        CHECK(IncppectCodec::encodeTiles(limited, prev.data(), cur.data(), image, 64, tilePrev, tileCur) == false);
+        CHECK(limited == "abc");
+    }
+
+    // truncated records and headers that do not fit the image are rejected
+    {
+        auto copy = prev;
+        CHECK(IncppectCodec::applyTiles(encoded.data(), encoded.size() - 16, copy.data(), copy.size(), tile) == false);
+        CHECK(IncppectCodec::applyTiles(encoded.data(), encoded.size(), copy.data(), copy.size() - 1, tile) == false);
+
+        auto bad = encoded;
+        const uint32_t tileSize = 0;
+        memcpy(bad.data() + 4*sizeof(uint32_t), &tileSize, sizeof(tileSize));
+        CHECK(IncppectCodec::applyTiles(bad.data(), bad.size(), copy.data(), copy.size(), tile) == false);
+
+        bad = encoded;
+        const uint32_t width = 0x40000000;
+        memcpy(bad.data(), &width, sizeof(width));
+        CHECK(IncppectCodec::applyTiles(bad.data(), bad.size(), copy.data(), copy.size(), tile) == false);
+    }
+}
+
+// [flags][nRemoved][nSet][removed indices][set indices][set values, float64]
+static std::string sparseRecord(uint32_t flags, const std::vector<uint32_t> & removed, const std::map<uint32_t, double> & set) {
+    std::string res;
+    const uint32_t header[3] = { flags, uint32_t(removed.size()), uint32_t(set.size()), };
+    res.append((const char *) header, sizeof(header));
+    res.append((const char *) removed.data(), removed.size()*sizeof(uint32_t));
+    for (const auto & [index, value] : set) {
+        res.append((const char *) &index, sizeof(index));
+    }
+    for (const auto & [index, value] : set) {
+        res.append((const char *) &value, sizeof(value));
+    }
+    return res;
+}
+
+static void testSparse() {
+    std::map<uint32_t, double> elements;
+
+    const auto full = sparseRecord(IncppectCodec::SparseFull, {}, { { 1, 1.5 }, { 7, -2.0 }, { 9, 3.25 }, });
+    CHECK(IncppectCodec::applySparse(full.data(), full.size(), elements));
+    CHECK((elements == std::map<uint32_t, double>{ { 1, 1.5 }, { 7, -2.0 }, { 9, 3.25 }, }));
+
+    const auto delta = sparseRecord(0, { 7, }, { { 9, 4.0 }, { 12, 0.5 }, });
+    CHECK(IncppectCodec::applySparse(delta.data(), delta.size(), elements));
+    CHECK((elements == std::map<uint32_t, double>{ { 1, 1.5 }, { 9, 4.0 }, { 12, 0.5 }, }));
+
+    // a truncated record leaves the elements unchanged
+    const auto before = elements;
+    const auto truncated = sparseRecord(IncppectCodec::SparseFull, { 1, }, { { 2, 2.0 }, });
+    CHECK(IncppectCodec::applySparse(truncated.data(), truncated.size() - 1, elements) == false);
+    CHECK(IncppectCodec::applySparse(truncated.data(), 8, elements) == false);
+    CHECK(elements == before);
+
+    // a full record replaces everything
+    const auto empty = sparseRecord(IncppectCodec::SparseFull, {}, {});
+    CHECK(IncppectCodec::applySparse(empty.data(), empty.size(), elements));
+    CHECK(elements.empty());
+}
+
+static void testQuantize() {
+    const float scale = 0.01f;
+    const float offset = -1.0f;
+
+    for (uint32_t mode : { IncppectCodec::Int8, IncppectCodec::Int16, IncppectCodec::Fixed, }) {
+        // odd counts, so that the padding of the record would read as extra elements of the 1 and 2 byte modes
+        for (size_t n : { 0, 1, 3, 5, 33, }) {
+            std::vector<float> values(n);
+            std::vector<double> valuesDouble(n);
+            for (size_t i = 0; i < n; ++i) {
+                values[i] = offset + scale*float(i % 100) + 0.003f;
+                valuesDouble[i] = values[i];
+            }
+
+            for (bool isDouble : { false, true, }) {
+                const char * src = isDouble ? (const char *) valuesDouble.data() : (const char *) values.data();
+                const size_t src_bytes = n*(isDouble ? sizeof(double) : sizeof(float));
+
+                std::string quantized;
+                IncppectCodec::quantize(quantized, src, src_bytes, isDouble, mode, scale, offset);
+                CHECK(quantized.size() == sizeof(uint32_t) + n*IncppectCodec::quantizedSize(mode));
+
+                // the records are padded to 4 bytes
+                quantized.resize((quantized.size() + 3)/4*4, 0);
+
+                std::vector<float> result;
+                IncppectCodec::dequantize(result, quantized.data(), quantized.size(), mode, scale, offset);
+                CHECK(result.size() == n);
+                for (size_t i = 0; i < result.size() && i < n; ++i) {
+                    CHECK(std::fabs(result[i] - values[i]) <= 0.5f*scale + 1e-5f);
+                }
+            }
+        }
+    }
+
+    // the integer modes saturate and send non-finite values as 0
+    {
+        const float values[4] = { 100.0f, -100.0f, NAN, INFINITY, };
+
+        std::string quantized;
+        IncppectCodec::quantize(quantized, (const char *) values, sizeof(values), false, IncppectCodec::Int8, 0.1f, 0.0f);
+
+        std::vector<double> result;
+        IncppectCodec::dequantize(result, quantized.data(), quantized.size(), IncppectCodec::Int8, 0.1f, 0.0f);
+        CHECK(result.size() == 4);
+        if (result.size() == 4) {
+            CHECK(std::fabs(result[0] - 12.7) < 1e-5);
+            CHECK(std::fabs(result[1] + 12.8) < 1e-5);
+            CHECK(result[2] == 0.0);
+            CHECK(result[3] == 0.0);
+        }
+    }
+
+    // a count larger than the data is clipped
+    {
+        const uint32_t data[2] = { 100, 0x04030201, };
+        std::vector<int> result;
+        IncppectCodec::dequantize(result, (const char *) data, sizeof(data), IncppectCodec::Int8, 1.0f, 0.0f);
+        CHECK((result == std::vector<int>{ 1, 2, 3, 4, }));
+
+        IncppectCodec::dequantize(result, (const char *) data, 2, IncppectCodec::Int8, 1.0f, 0.0f);
+        CHECK(result.empty());
+    }
+}
+
+int main() {
+    testXorRle();
+    testTiles();
+    testSparse();
+    testQuantize();
+
+    return TEST_RESULT();
+}
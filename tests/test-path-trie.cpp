@@ -0,0 +1,143 @@
+/*! \file test-path-trie.cpp
+ *  \brief Lookups and wildcard expansion of IncppectPathTrie
+ *  \author Georgi Gerganov
+ */
+
+#include "incppect/path_trie.h"
+
+#include "test.h"
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+static std::set<std::string> paths(const std::vector<IncppectPathTrie::Match> & matches) {
+    std::set<std::string> res;
+    for (const auto & match : matches) {
+        res.insert(match.path);
+    }
+    return res;
+}
+
+int main() {
+    IncppectPathTrie trie;
+
+    int32_t nBalls = 3;
+
+    trie.insert("state.ball[%d].x", 0);
+    trie.insert("state.ball[%d].y", 1);
+    trie.insert("state.dt", 2);
+    trie.insert("state.grid[%d][%d]", 3);
+    trie.insert("state.player.x", 4);
+    trie.setExtent("state.ball", [&](const std::vector<int> &) { return nBalls; });
+    trie.setExtent("state.grid", [](const std::vector<int> &) { return 2; });
+    trie.setExtent("state.grid[%d]", [](const std::vector<int> & idxs) { return idxs.empty() ? 0 : idxs[0] + 1; });
+
+    // lookups
+    {
+        CHECK(trie.find("state.ball[%d].x") == 0);
+        CHECK(trie.find("state.dt") == 2);
+        CHECK(trie.find("state.grid[%d][%d]") == 3);
+        CHECK(trie.find("state.ball") == -1);
+        CHECK(trie.find("state.ball[%d].z") == -1);
+        CHECK(trie.find("missing") == -1);
+
+        std::string path;
+        std::vector<int> idxs;
+        IncppectPathTrie::parse("state.grid[1][0]", path, idxs);
+        CHECK(path == "state.grid[%d][%d]");
+        CHECK((idxs == std::vector<int>{ 1, 0, }));
+
+        IncppectPathTrie::parse("state.ball[*].x", path, idxs);
+        CHECK(path == "state.ball[*].x");
+        CHECK(idxs.empty());
+        CHECK(IncppectPathTrie::isPattern(path));
+    }
+
+    std::vector<IncppectPathTrie::Match> matches;
+
+    // all elements of an array
+    {
+        trie.expand("state.ball[*].x", {}, matches);
+        CHECK(matches.size() == 3);
+        for (int i = 0; i < int(matches.size()); ++i) {
+            CHECK(matches[i].id == 0);
+            CHECK((matches[i].idxs == std::vector<int>{ i, }));
+            CHECK(matches[i].path == "state.ball[" + std::to_string(i) + "].x");
+        }
+    }
+
+    // extents that depend on the enclosing indices
+    {
+        trie.expand("state.grid[*][*]", {}, matches);
+        CHECK((paths(matches) == std::set<std::string>{ "state.grid[0][0]", "state.grid[1][0]", "state.grid[1][1]", }));
+
+        trie.expand("state.grid[%d][*]", { 1, }, matches);
+        CHECK((paths(matches) == std::set<std::string>{ "state.grid[1][0]", "state.grid[1][1]", }));
+    }
+
+    // "[%d]" takes its value from the indices
+    {
+        trie.expand("state.ball[%d].y", { 2, }, matches);
+        CHECK(matches.size() == 1 && matches[0].id == 1 && matches[0].path == "state.ball[2].y");
+
+        trie.expand("state.ball[%d].y", {}, matches);
+        CHECK(matches.empty());
+    }
+
+    // any field and everything under a node
+    {
+        trie.expand("state.*.x", {}, matches);
+        CHECK((paths(matches) == std::set<std::string>{ "state.player.x", }));
+
+        trie.expand("state.ball[*].*", {}, matches);
+        CHECK(matches.size() == 6);
+
+        trie.expand("state.*", {}, matches);
+        CHECK(matches.size() == 3*2 + 1 + 3 + 1);
+        CHECK(paths(matches).count("state.grid[1][1]") == 1);
+        CHECK(paths(matches).count("state.dt") == 1);
+    }
+
+    // no matches
+    {
+        trie.expand("state.missing[*]", {}, matches);
+        CHECK(matches.empty());
+
+        trie.expand("other.*", {}, matches);
+        CHECK(matches.empty());
+    }
+
+    // cached expansions follow the extents and the registered vars
+    {
+        IncppectPathTrie::Expansion expansion;
+        expansion.pattern = "state.ball[*].x";
+
+        CHECK(trie.refresh(expansion));
+        CHECK(expansion.matches.size() == 3);
+        CHECK(trie.refresh(expansion) == false);
+        const auto version = expansion.version;
+
+        nBalls = 5;
+        CHECK(trie.refresh(expansion));
+        CHECK(expansion.matches.size() == 5);
+        CHECK(expansion.version == version + 1);
+
+        nBalls = 0;
+        CHECK(trie.refresh(expansion));
+        CHECK(expansion.matches.empty());
+
+        IncppectPathTrie::Expansion fields;
+        fields.pattern = "state.*.x";
+        CHECK(trie.refresh(fields));
+        CHECK(fields.matches.size() == 1);
+
+        trie.insert("state.enemy.x", 5);
+        CHECK(trie.refresh(fields));
+        CHECK((paths(fields.matches) == std::set<std::string>{ "state.enemy.x", "state.player.x", }));
+        CHECK(trie.refresh(fields) == false);
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,20 @@
+/*! \file test.h
+ *  \brief Minimal checks for the tests
+ *  \author Georgi Gerganov
+ */
+
+#pragma once
+
+#include <cstdio>
+
+static int g_nFailed = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_nFailed; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (g_nFailed == 0 ? 0 : (fprintf(stderr, "%d checks failed\n", g_nFailed), 1))
@@ -0,0 +1,239 @@
+/*! \file main.cpp
+ *  \brief Relay - serves the vars of an upstream incppect service to many downstream clients
+ *  \author Georgi Gerganov
+ */
+
+#include "incppect/incppect.h"
+#include "incppect/client.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using incppect = Incppect<false>;
+
+// The relay is a single upstream client of the application and an incppect service of its own.
+//
+// The vars of the upstream service are registered from its schema. A downstream request for a var subscribes to it
+// upstream and the latest received data is served from the cache of the upstream client, so the application sends
+// every var once, no matter how many viewers there are. The deltas and the compression towards the viewers are done
+// by the relay.
+//
+// Upstream subscriptions that no viewer requested for tLastRequestTimeout_ms are dropped.
+//
+// The upstream socket is polled from a timer on the service loop. The interval is 1 ms while frames arrive and
+// backs off to tPollIdle_ms while upstream is idle.
+//
+// Writes to settable vars are forwarded upstream from the service loop, on which the upstream client lives.
+struct Relay {
+    std::string uri;
+    int64_t tIdle_ms = 3000;
+    int64_t tReconnect_ms = 1000;
+    int64_t tSchema_ms = 5000;
+    int64_t tPollIdle_ms = 8;
+    int64_t tPoll_ms = 1;
+
+    IncppectClient upstream;
+
+    std::set<std::string> registered;
+    std::set<std::string> extents;
+    std::map<int32_t, int64_t> tLastUsed;
+
+    // the data is received padded to 4 bytes - the vars are trimmed to the size of their type and shape in the
+    // schema. the raw vars are served padded
+    std::map<std::string, size_t> sizes;
+    std::set<std::string> strings;
+
+    int64_t tCur = 0;
+    int64_t tLastConnect = 0;
+    int64_t tLastSchema = 0;
+    int64_t tLastPrune = 0;
+
+    void init() {
+        upstream.onSchema([this](const auto & schema) {
+            for (const auto & entry : schema) {
+                add(entry);
+            }
+        });
+    }
+
+    // data of an upstream var, subscribing to it if needed
+    std::string_view get(const std::string & path, const std::vector<int> & idxs) {
+        const auto id = upstream.subscribe(path, idxs);
+        tLastUsed[id] = tCur;
+
+        auto data = upstream.data(id);
+        if (const auto it = sizes.find(path); it != sizes.end()) {
+            data = data.substr(0, std::min(data.size(), it->second));
+        } else if (strings.count(path)) {
+            // the length of a string is not in the schema - the padding is made of zeros
+            for (int i = 0; i < 3 && data.empty() == false && data.back() == '\0'; ++i) {
+                data.remove_suffix(1);
+            }
+        }
+
+        return data;
+    }
+
+    // register an upstream var on the relay
+    void add(const IncppectClient::SchemaEntry & entry) {
+        // the built-in vars describe the connection to the relay, not the upstream one
+        if (entry.path.rfind("incppect.", 0) == 0) {
+            return;
+        }
+
+        const auto type = incppect::ElementType(entry.type);
+        if (type == incppect::ElementType::String) {
+            strings.insert(entry.path);
+        } else if (type != incppect::ElementType::Raw) {
+            size_t size = incppect::elementSize(type);
+            for (const auto dim : entry.shape) {
+                size *= size_t(std::max(dim, 0));
+            }
+            sizes[entry.path] = size;
+        }
+
+        if (registered.insert(entry.path).second == false) {
+            return;
+        }
+
+        incppect::VarOptions options;
+        options.type = type;
+        options.endianness = incppect::Endianness(entry.endianness);
+        options.shape = entry.shape;
+        options.tBudget_us = 0; // the getters use the upstream client, which belongs to the service loop
+
+        if (entry.isSettable) {
+            // writes of the viewers are forwarded upstream without subscribing to the var
+            incppect::getInstance().var(entry.path, [this, path = entry.path](const auto & idxs) {
+                return get(path, idxs);
+            }, [this, path = entry.path](const auto & idxs, std::string_view data) {
+                upstream.set(upstream.add(path, idxs), data);
+            }, options);
+        } else {
+            incppect::getInstance().var(entry.path, [this, path = entry.path](const auto & idxs) {
+                return get(path, idxs);
+            }, options);
+        }
+
+        // the extents of the arrays are not part of the schema - they are taken from the size of an upstream
+        // wildcard subscription, e.g. the extent of "state.ball" is the number of vars in "state.ball[*].x"
+        static constexpr std::string_view kIndex = "[%d]";
+        for (auto pos = entry.path.find(kIndex); pos != std::string::npos; pos = entry.path.find(kIndex, pos + 1)) {
+            const auto array = entry.path.substr(0, pos);
+            if (extents.insert(array).second == false) {
+                continue;
+            }
+
+            incppect::getInstance().extent(array, [this, path = entry.path, pos](const std::vector<int> & idxs) {
+                // "[%d]" before the array take the given indices, the ones after it index the first element
+                std::string pattern;
+                size_t k = 0;
+                for (size_t i = 0; i < path.size(); ) {
+                    if (path.compare(i, kIndex.size(), kIndex) == 0) {
+                        pattern += i == pos ? "[*]" : "[" + std::to_string(k < idxs.size() ? idxs[k] : 0) + "]";
+                        k += i == pos ? 0 : 1;
+                        i += kIndex.size();
+                    } else {
+                        pattern += path[i++];
+                    }
+                }
+
+                const auto id = upstream.subscribe(pattern);
+                tLastUsed[id] = tCur;
+                return int32_t(upstream.var(id).layout.size());
+            });
+        }
+    }
+
+    // called periodically from the service loop, sets the interval until the next call
+    void poll() {
+        tCur = incppect::timestamp();
+        tPoll_ms = std::min(2 * tPoll_ms, tPollIdle_ms);
+
+        if (upstream.isConnected() == false) {
+            if (tCur - tLastConnect < tReconnect_ms) {
+                return;
+            }
+            tLastConnect = tCur;
+
+            if (upstream.connect(uri) == false) {
+                fprintf(stderr, "[relay] failed to connect to '%s'\n", uri.c_str());
+                return;
+            }
+            printf("[relay] connected to '%s'\n", uri.c_str());
+            tLastSchema = 0;
+        }
+
+        // new vars can be registered upstream at any time
+        if (tCur - tLastSchema > tSchema_ms) {
+            upstream.requestSchema();
+            tLastSchema = tCur;
+        }
+
+        if (tCur - tLastPrune > tIdle_ms) {
+            for (auto it = tLastUsed.begin(); it != tLastUsed.end(); ) {
+                if (tCur - it->second > tIdle_ms) {
+                    upstream.unsubscribe(it->first);
+                    it = tLastUsed.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            tLastPrune = tCur;
+        }
+
+        const auto nFrames = upstream.poll(0);
+        if (nFrames < 0) {
+            fprintf(stderr, "[relay] disconnected from '%s'\n", uri.c_str());
+        } else if (nFrames > 0) {
+            tPoll_ms = 1;
+        }
+    }
+};
+
+static void onPollTimer(us_timer_t * timer) {
+    auto & relay = **(Relay **) us_timer_ext(timer);
+
+    const auto tPoll_ms = relay.tPoll_ms;
+    relay.poll();
+    if (relay.tPoll_ms != tPoll_ms) {
+        us_timer_set(timer, onPollTimer, int(relay.tPoll_ms), int(relay.tPoll_ms));
+    }
+}
+
+int main(int argc, char ** argv) {
+    printf("Usage: %s upstream [port] [httpRoot] [unixSocketPath]\n", argv[0]);
+    printf("    upstream - e.g. ws://localhost:3000/incppect or unix:/tmp/incppect.sock\n");
+
+    if (argc < 2) {
+        return -1;
+    }
+
+    Relay relay;
+    relay.uri = argv[1];
+
+    incppect::Parameters parameters;
+    parameters.portListen = argc > 2 ? atoi(argv[2]) : 3001;
+    parameters.httpRoot = argc > 3 ? argv[3] : ".";
+    parameters.unixSocketPath = argc > 4 ? argv[4] : "";
+    parameters.resources = { "", "index.html", };
+    parameters.applyWritesOnLoop = true;
+
+    relay.tIdle_ms = parameters.tLastRequestTimeout_ms;
+    relay.tPollIdle_ms = std::max<int64_t>(parameters.tMinUpdate_ms / 2, 1);
+    relay.init();
+
+    // the upstream client is polled on the thread of the service, so the getters can return views of its data
+    auto timer = us_create_timer((us_loop_t *) uWS::Loop::get(), 0, sizeof(Relay *));
+    *(Relay **) us_timer_ext(timer) = &relay;
+    us_timer_set(timer, onPollTimer, int(relay.tPoll_ms), int(relay.tPoll_ms));
+
+    incppect::getInstance().run(parameters);
+
+    return 0;
+}